@@ -0,0 +1,86 @@
+#include "byteio.h"
+
+#include <limits>
+
+ByteSource::~ByteSource()
+{
+}
+
+ByteSink::~ByteSink()
+{
+}
+
+StreamSource::StreamSource(std::istream & is)
+    : _is(is)
+{
+}
+
+StreamSource::StreamSource(const std::string & fname)
+    : _is(_if)
+{
+    _if.open(fname,std::ios::binary);
+}
+
+bool StreamSource::read(uint8_t * buf,size_t n)
+{
+    return bool(_is.read((char *)buf,n));
+}
+
+const uint8_t * StreamSource::next(size_t max,size_t & n)
+{
+    n = 0;
+
+    if(!_is)
+    {
+        return nullptr;
+    }
+
+    _buff.resize(max);
+    _is.read((char *)_buff.data(),_buff.size());
+    n = _is.gcount();
+
+    return n==0 ? nullptr : _buff.data();
+}
+
+StreamSink::StreamSink(std::ostream & os)
+    : _os(os)
+{
+}
+
+StreamSink::StreamSink(const std::string & fname)
+    : _os(_of)
+{
+    _of.open(fname,std::ios::binary);
+}
+
+size_t StreamSink::maxChunk() const
+{
+    return std::numeric_limits<size_t>::max();
+}
+
+uint8_t * StreamSink::buffer(size_t n)
+{
+    _buff.resize(n);
+    return _buff.data();
+}
+
+bool StreamSink::commit(size_t n)
+{
+    return bool(_os.write((char *)_buff.data(),n));
+}
+
+bool StreamSink::writeAt(uint64_t offset,const uint8_t * data,size_t n)
+{
+    std::streampos end = _os.tellp();
+
+    _os.seekp(offset,std::ios::beg);
+    _os.write((const char *)data,n);
+    _os.seekp(end);
+
+    return bool(_os);
+}
+
+bool StreamSink::good() const
+{
+    return bool(_os);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Byte level I/O backends of WavPcmReadJob and WavPcmWriteJob.
+// The stream backends below wrap std::istream/std::ostream,
+// uring.h adds asynchronous io_uring based ones on Linux.
+
+class ByteSource {
+public:
+    virtual ~ByteSource();
+
+    // Blocking read of exactly n bytes, used for headers
+    virtual bool read(uint8_t * buf,size_t n) = 0;
+
+    // Next piece of the stream of at most max bytes. The data stays
+    // valid until the next call. Returns nullptr/n==0 at the end.
+    virtual const uint8_t * next(size_t max,size_t & n) = 0;
+};
+
+class ByteSink {
+public:
+    virtual ~ByteSink();
+
+    // Largest n buffer() accepts
+    virtual size_t maxChunk() const = 0;
+
+    // Room for the next n bytes of the stream. Fill it and commit()
+    virtual uint8_t * buffer(size_t n) = 0;
+
+    // Append the n bytes filled in the last buffer()
+    virtual bool commit(size_t n) = 0;
+
+    // Overwrite already written bytes, e.g. header sizes
+    virtual bool writeAt(uint64_t offset,const uint8_t * data,size_t n) = 0;
+
+    virtual bool good() const = 0;
+};
+
+class StreamSource : public ByteSource {
+public:
+    StreamSource(std::istream & is);
+    StreamSource(const std::string & fname);
+
+    bool read(uint8_t * buf,size_t n) override;
+    const uint8_t * next(size_t max,size_t & n) override;
+
+private:
+    std::ifstream _if;
+    std::istream & _is;
+    std::vector<uint8_t> _buff;
+};
+
+class StreamSink : public ByteSink {
+public:
+    StreamSink(std::ostream & os);
+    StreamSink(const std::string & fname);
+
+    size_t maxChunk() const override;
+    uint8_t * buffer(size_t n) override;
+    bool commit(size_t n) override;
+    bool writeAt(uint64_t offset,const uint8_t * data,size_t n) override;
+    bool good() const override;
+
+private:
+    std::ofstream _of;
+    std::ostream & _os;
+    std::vector<uint8_t> _buff;
+};
@@ -0,0 +1,54 @@
+// @Autor: Sebastian Kloska (sebastian.kloska@snafu.de)
+
+#pragma once
+
+#include <memory>
+#include <set>
+
+// AudioEffect is the base class for effects that can process
+// audio and have a subsequent effect (next).
+
+struct AudioEffect {
+    virtual ~AudioEffect() = default;
+    virtual void process(float* buf, size_t num) = 0;
+    std::shared_ptr<AudioEffect> next;
+};
+
+// A dummy effect -- doing nothing
+struct DummyEffect : public AudioEffect {
+public:
+    void process(float *buf, size_t num) override {
+    }
+};
+
+
+// Implement a function that checks if there is a feedback loop
+// in the effects chain.
+//
+// 1 If a loop can be found we return true.
+// 2 Additionaly we return the length of the chain until the end or the loop
+//
+// Compelexity should be O(N)* O(log(N/2))
+
+inline bool detect_feedback(AudioEffect * pEffect,int &n)
+{
+    // std::set of pointers. Traverse through the chain
+    // and check wether we have seen the current pointer already
+
+    std::set<AudioEffect *> ptrSet;
+
+    n = 0;
+    // Loop until end-of-chain or a loop back is detected
+    while(pEffect != nullptr) {
+        // have we seen the position already ?
+        if(ptrSet.find(pEffect) != ptrSet.end()) {
+            n = ptrSet.size();
+            return true;
+        }
+        // add the current position to the set
+        ptrSet.insert(pEffect);
+        pEffect = pEffect->next.get();
+    }
+    n = ptrSet.size();
+    return false;
+}
@@ -0,0 +1,664 @@
+#include "flac.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+    const int maxFixedOrder = 4;
+    const int maxLpcOrder = 8;
+    const int maxPartitionOrder = 8;
+    // Rice parameters, 4 bits up to 14 and 5 bits (RICE2) up to 30,
+    // all ones is the escape code
+    const int maxRiceParam = 14;
+    const int maxRice2Param = 30;
+
+    std::array<uint8_t,256> makeCrc8Table()
+    {
+        std::array<uint8_t,256> table;
+        for(int i=0;i<256;i++)
+        {
+            uint8_t c = uint8_t(i);
+            for(int j=0;j<8;j++)
+            {
+                c = (c & 0x80) ? uint8_t((c << 1) ^ 0x07) : uint8_t(c << 1);
+            }
+            table[i] = c;
+        }
+        return table;
+    }
+
+    std::array<uint16_t,256> makeCrc16Table()
+    {
+        std::array<uint16_t,256> table;
+        for(int i=0;i<256;i++)
+        {
+            uint16_t c = uint16_t(i << 8);
+            for(int j=0;j<8;j++)
+            {
+                c = (c & 0x8000) ? uint16_t((c << 1) ^ 0x8005) : uint16_t(c << 1);
+            }
+            table[i] = c;
+        }
+        return table;
+    }
+
+    const std::array<uint8_t,256> crc8Table = makeCrc8Table();
+    const std::array<uint16_t,256> crc16Table = makeCrc16Table();
+
+    uint8_t crc8(const uint8_t * p,size_t n)
+    {
+        const std::array<uint8_t,256> & t = crc8Table;
+        uint8_t c = 0;
+        for(size_t i=0;i<n;i++)
+        {
+            c = t[c ^ p[i]];
+        }
+        return c;
+    }
+
+    uint16_t crc16(const uint8_t * p,size_t n)
+    {
+        const std::array<uint16_t,256> & t = crc16Table;
+        uint16_t c = 0;
+        for(size_t i=0;i<n;i++)
+        {
+            c = uint16_t((c << 8) ^ t[(c >> 8) ^ p[i]]);
+        }
+        return c;
+    }
+
+    // Frame header block size code, 6/7 mean explicit 8/16 bit size
+    int blockSizeCode(size_t n)
+    {
+        if(n==192)
+        {
+            return 1;
+        }
+        for(int k=0;k<4;k++)
+        {
+            if(n == size_t(576) << k)
+            {
+                return 2 + k;
+            }
+        }
+        for(int k=0;k<8;k++)
+        {
+            if(n == size_t(256) << k)
+            {
+                return 8 + k;
+            }
+        }
+        return n <= 256 ? 6 : 7;
+    }
+
+    int sampleSizeCode(int bits)
+    {
+        switch(bits)
+        {
+        case 8:  return 1;
+        case 12: return 2;
+        case 16: return 4;
+        case 20: return 5;
+        case 24: return 6;
+        default: return 0; // from STREAMINFO
+        }
+    }
+
+    // Coefficient precision by block size as libFLAC picks it
+    int lpcPrecision(size_t n)
+    {
+        return n <= 192 ? 7 : n <= 384 ? 8 : n <= 576 ? 9 : n <= 1152 ? 10 : n <= 2304 ? 11 : n <= 4608 ? 12 : 13;
+    }
+
+    // Best Rice partitioning of residual r[order..n). Returns the
+    // estimated size in bits, parameters in params
+    uint64_t riceSize(const int32_t * r,size_t n,int order,int & partitionOrder,std::vector<int> & params)
+    {
+        int maxOrder = 0;
+        while(maxOrder < maxPartitionOrder && n % (size_t(2) << maxOrder) == 0
+              && (n >> (maxOrder + 1)) > size_t(order))
+        {
+            maxOrder++;
+        }
+
+        // Sums of the folded residual of the finest partitions
+        std::vector<uint64_t> sums(size_t(1) << maxOrder,0);
+        const size_t len = n >> maxOrder;
+
+        for(size_t i=order;i<n;i++)
+        {
+            uint32_t u = (uint32_t(r[i]) << 1) ^ uint32_t(r[i] >> 31);
+            sums[i / len] += u;
+        }
+
+        uint64_t best = ~uint64_t(0);
+        std::vector<int> ks;
+
+        for(int po=maxOrder;po>=0;po--)
+        {
+            const size_t parts = size_t(1) << po;
+            const size_t plen = n >> po;
+            uint64_t bits = 0;
+            bool rice2 = false;
+
+            ks.resize(parts);
+
+            for(size_t p=0;p<parts;p++)
+            {
+                const uint64_t cnt = p==0 ? plen - order : plen;
+                const uint64_t sum = sums[p];
+                uint64_t pbest = ~uint64_t(0);
+
+                for(int k=0;k<=maxRice2Param;k++)
+                {
+                    uint64_t b = cnt * (k + 1) + (sum >> k);
+                    if(b < pbest)
+                    {
+                        pbest = b;
+                        ks[p] = k;
+                    }
+                }
+                bits += pbest;
+                rice2 = rice2 || ks[p] > maxRiceParam;
+            }
+
+            bits += parts * (rice2 ? 5 : 4);
+
+            if(bits < best)
+            {
+                best = bits;
+                partitionOrder = po;
+                params = ks;
+            }
+
+            // Merge pairs for the next coarser order
+            for(size_t p=0;p<parts/2;p++)
+            {
+                sums[p] = sums[2*p] + sums[2*p+1];
+            }
+        }
+
+        return best + 2 + 4;
+    }
+
+    // Levinson-Durbin, lp[o-1] are the coefficients of order o
+    int lpcCoefficients(const double * autoc,int maxOrder,std::vector<std::vector<double>> & lp)
+    {
+        std::vector<double> lpc(maxOrder,0.0);
+        double err = autoc[0];
+
+        lp.assign(maxOrder,std::vector<double>());
+
+        for(int i=0;i<maxOrder;i++)
+        {
+            double r = -autoc[i+1];
+            for(int j=0;j<i;j++)
+            {
+                r -= lpc[j] * autoc[i-j];
+            }
+            r /= err;
+
+            lpc[i] = r;
+
+            int j = 0;
+            for(;j<(i>>1);j++)
+            {
+                double tmp = lpc[j];
+                lpc[j] += r * lpc[i-1-j];
+                lpc[i-1-j] += r * tmp;
+            }
+            if(i & 1)
+            {
+                lpc[j] += lpc[j] * r;
+            }
+
+            err *= (1.0 - r * r);
+
+            lp[i].resize(i+1);
+            for(int k=0;k<=i;k++)
+            {
+                lp[i][k] = -lpc[k];
+            }
+
+            if(err <= 0.0)
+            {
+                return i + 1;
+            }
+        }
+        return maxOrder;
+    }
+}
+
+class FlacEncoder::BitWriter {
+public:
+    BitWriter(std::vector<uint8_t> & out)
+        : _out(out)
+    {
+    }
+
+    void put(uint32_t v,int bits)
+    {
+        if(bits==0)
+        {
+            return;
+        }
+        _acc = (_acc << bits) | (uint64_t(v) & ((uint64_t(1) << bits) - 1));
+        _n += bits;
+
+        while(_n >= 8)
+        {
+            _n -= 8;
+            _out.push_back(uint8_t(_acc >> _n));
+        }
+    }
+
+    void putSigned(int32_t v,int bits)
+    {
+        put(uint32_t(v),bits);
+    }
+
+    void putUnary(uint32_t q)
+    {
+        for(;q >= 32;q -= 32)
+        {
+            put(0,32);
+        }
+        put(1,q + 1);
+    }
+
+    void putRice(int32_t r,int k)
+    {
+        uint32_t u = (uint32_t(r) << 1) ^ uint32_t(r >> 31);
+        uint32_t q = u >> k;
+
+        if(q + 1 + k <= 32)
+        {
+            put((uint32_t(1) << k) | (u & ((uint32_t(1) << k) - 1)),q + 1 + k);
+        }
+        else
+        {
+            putUnary(q);
+            put(u,k);
+        }
+    }
+
+    void align()
+    {
+        if(_n > 0)
+        {
+            put(0,8 - _n);
+        }
+    }
+
+private:
+    std::vector<uint8_t> & _out;
+    uint64_t _acc = 0;
+    int _n = 0;
+};
+
+FlacEncoder::FlacEncoder(int bits,uint32_t blockSize)
+    : _bits(bits)
+    , _blockSize(blockSize)
+{
+    if(bits < 4 || bits > 24)
+    {
+        std::stringstream ss;
+        ss << "FLAC output supports 4..24 bits per sample, not " << bits;
+        throw std::runtime_error(ss.str());
+    }
+
+    if(blockSize < 16 || blockSize > 65535)
+    {
+        std::stringstream ss;
+        ss << "FLAC block size has to be 16..65535, not " << blockSize;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void FlacEncoder::encodeFrame(const int32_t * x,size_t n,uint64_t frame,std::vector<uint8_t> & out) const
+{
+    if(n==0 || n > _blockSize)
+    {
+        std::stringstream ss;
+        ss << "FLAC frame of " << n << " samples, block size is " << _blockSize;
+        throw std::runtime_error(ss.str());
+    }
+
+    const size_t start = out.size();
+    BitWriter bw(out);
+
+    const int bsCode = blockSizeCode(n);
+
+    bw.put(0x3ffe,14);  // sync
+    bw.put(0,1);
+    bw.put(0,1);        // fixed block size, frame numbers
+    bw.put(bsCode,4);
+    bw.put(0,4);        // sample rate from STREAMINFO
+    bw.put(0,4);        // mono
+    bw.put(sampleSizeCode(_bits),3);
+    bw.put(0,1);
+
+    // Frame number, UTF-8 like coding of up to 36 bits
+    if(frame < 0x80)
+    {
+        bw.put(uint32_t(frame),8);
+    }
+    else
+    {
+        int len = 2;
+        while(len < 7 && frame >= (uint64_t(1) << (5 * len + 1)))
+        {
+            len++;
+        }
+
+        // len leading ones, then the top bits of the number
+        bw.put(((0xff00 >> len) & 0xff) | uint32_t(frame >> (6 * (len - 1))),8);
+
+        for(int i=len-2;i>=0;i--)
+        {
+            bw.put(0x80 | uint32_t((frame >> (6 * i)) & 0x3f),8);
+        }
+    }
+
+    if(bsCode==6)
+    {
+        bw.put(uint32_t(n - 1),8);
+    }
+    else if(bsCode==7)
+    {
+        bw.put(uint32_t(n - 1),16);
+    }
+
+    bw.put(crc8(out.data() + start,out.size() - start),8);
+
+    encodeSubframe(x,n,bw);
+    bw.align();
+
+    uint16_t crc = crc16(out.data() + start,out.size() - start);
+    bw.put(crc,16);
+}
+
+void FlacEncoder::encodeSubframe(const int32_t * x,size_t n,BitWriter & bw) const
+{
+    if(std::all_of(x,x+n,[x](int32_t v){ return v==x[0]; }))
+    {
+        bw.put(0,8);  // CONSTANT, no wasted bits
+        bw.putSigned(x[0],_bits);
+        return;
+    }
+
+    // Verbatim is the size to beat
+    uint64_t bestBits = uint64_t(n) * _bits;
+    int bestType = -1;  // -1 verbatim, 0..4 fixed, 32+ order-1 LPC
+    int bestPo = 0;
+    int bestShift = 0;
+    const int precision = lpcPrecision(n);
+    std::vector<int> bestParams;
+    std::vector<int32_t> bestQlp;
+    std::vector<int32_t> best(n);
+    std::vector<int32_t> r(n);
+    std::vector<int> params;
+    int po = 0;
+
+    for(int order=0;order<=maxFixedOrder && size_t(order) < n;order++)
+    {
+        for(size_t i=order;i<n;i++)
+        {
+            int64_t e;
+            switch(order)
+            {
+            case 0: e = x[i]; break;
+            case 1: e = int64_t(x[i]) - x[i-1]; break;
+            case 2: e = int64_t(x[i]) - 2 * int64_t(x[i-1]) + x[i-2]; break;
+            case 3: e = int64_t(x[i]) - 3 * int64_t(x[i-1]) + 3 * int64_t(x[i-2]) - x[i-3]; break;
+            default: e = int64_t(x[i]) - 4 * int64_t(x[i-1]) + 6 * int64_t(x[i-2]) - 4 * int64_t(x[i-3]) + x[i-4]; break;
+            }
+            r[i] = int32_t(e);
+        }
+
+        uint64_t bits = 8 + uint64_t(order) * _bits + riceSize(r.data(),n,order,po,params);
+
+        if(bits < bestBits)
+        {
+            bestBits = bits;
+            bestType = order;
+            bestPo = po;
+            bestParams = params;
+            best.swap(r);
+        }
+    }
+
+    const int lpcOrder = int(std::min<size_t>(maxLpcOrder,n / 2));
+
+    if(lpcOrder > 0)
+    {
+        // Autocorrelation of a Tukey(0.5) windowed copy
+        std::vector<double> w(n);
+        const double taper = 0.25 * double(n);
+
+        for(size_t i=0;i<n;i++)
+        {
+            double g = 1.0;
+            double d = std::min(double(i),double(n - 1 - i));
+            if(d < taper)
+            {
+                g = 0.5 - 0.5 * std::cos(M_PI * d / taper);
+            }
+            w[i] = g * double(x[i]);
+        }
+
+        std::vector<double> autoc(lpcOrder + 1,0.0);
+        for(int l=0;l<=lpcOrder;l++)
+        {
+            double s = 0.0;
+            for(size_t i=l;i<n;i++)
+            {
+                s += w[i] * w[i-l];
+            }
+            autoc[l] = s;
+        }
+
+        std::vector<std::vector<double>> lp;
+        int orders = autoc[0] > 0.0 ? lpcCoefficients(autoc.data(),lpcOrder,lp) : 0;
+
+        std::vector<int32_t> qlp;
+
+        for(int order=1;order<=orders;order++)
+        {
+            const std::vector<double> & c = lp[order-1];
+            double cmax = 0.0;
+            for(double v : c)
+            {
+                cmax = std::max(cmax,std::fabs(v));
+            }
+            if(!(cmax > 0.0) || !std::isfinite(cmax))
+            {
+                continue;
+            }
+
+            int log2cmax;
+            std::frexp(cmax,&log2cmax);
+            log2cmax--;
+
+            int shift = precision - 1 - log2cmax - 1;
+            if(shift < 0)
+            {
+                continue;
+            }
+            shift = std::min(shift,15);
+
+            // Quantize with error feedback
+            const int32_t qmax = (1 << (precision - 1)) - 1;
+            const int32_t qmin = -(1 << (precision - 1));
+            double err = 0.0;
+
+            qlp.resize(order);
+            for(int j=0;j<order;j++)
+            {
+                err += c[j] * double(1 << shift);
+                int32_t q = int32_t(std::lround(err));
+                q = std::max(qmin,std::min(qmax,q));
+                err -= q;
+                qlp[j] = q;
+            }
+
+            bool fits = true;
+            for(size_t i=order;i<n;i++)
+            {
+                int64_t sum = 0;
+                for(int j=0;j<order;j++)
+                {
+                    sum += int64_t(qlp[j]) * x[i-j-1];
+                }
+                int64_t e = int64_t(x[i]) - (sum >> shift);
+                if(e > INT32_MAX / 2 || e < INT32_MIN / 2)
+                {
+                    fits = false;
+                    break;
+                }
+                r[i] = int32_t(e);
+            }
+            if(!fits)
+            {
+                continue;
+            }
+
+            uint64_t bits = 8 + uint64_t(order) * (_bits + precision) + 4 + 5
+                + riceSize(r.data(),n,order,po,params);
+
+            if(bits < bestBits)
+            {
+                bestBits = bits;
+                bestType = 32 + order - 1;
+                bestPo = po;
+                bestParams = params;
+                bestShift = shift;
+                bestQlp = qlp;
+                best.swap(r);
+            }
+        }
+    }
+
+    if(bestType < 0)
+    {
+        bw.put(0x02,8);  // VERBATIM
+        for(size_t i=0;i<n;i++)
+        {
+            bw.putSigned(x[i],_bits);
+        }
+        return;
+    }
+
+    const int order = bestType < 32 ? bestType : bestType - 31;
+
+    bw.put(0,1);
+    bw.put(bestType < 32 ? 8 + bestType : bestType,6);
+    bw.put(0,1);
+
+    for(int i=0;i<order;i++)
+    {
+        bw.putSigned(x[i],_bits);
+    }
+
+    if(bestType >= 32)
+    {
+        bw.put(precision - 1,4);
+        bw.putSigned(bestShift,5);
+        for(int32_t q : bestQlp)
+        {
+            bw.putSigned(q,precision);
+        }
+    }
+
+    const int paramBits = *std::max_element(bestParams.begin(),bestParams.end()) > maxRiceParam ? 5 : 4;
+
+    bw.put(paramBits==5 ? 1 : 0,2);
+    bw.put(bestPo,4);
+
+    const size_t plen = n >> bestPo;
+    for(size_t p=0;p<bestParams.size();p++)
+    {
+        const int k = bestParams[p];
+        bw.put(k,paramBits);
+
+        for(size_t i=p==0 ? order : p * plen;i<(p + 1) * plen;i++)
+        {
+            bw.putRice(best[i],k);
+        }
+    }
+}
+
+void FlacEncoder::writeHeader(const StreamInfo & info,const std::vector<SeekPoint> & points,
+                              size_t seekCapacity,std::vector<uint8_t> & out)
+{
+    // Frames refer to STREAMINFO for the rate
+    if(info.sampleRate < 1 || info.sampleRate > maxSampleRate)
+    {
+        std::stringstream ss;
+        ss << "FLAC sample rate has to be 1.." << maxSampleRate << " Hz, not " << info.sampleRate;
+        throw std::runtime_error(ss.str());
+    }
+
+    BitWriter bw(out);
+
+    for(char c : std::string("fLaC"))
+    {
+        bw.put(uint8_t(c),8);
+    }
+
+    bw.put(seekCapacity==0 ? 1 : 0,1);
+    bw.put(0,7);        // STREAMINFO
+    bw.put(34,24);
+
+    bw.put(info.blockSize,16);
+    bw.put(info.blockSize,16);
+    bw.put(info.minFrameSize,24);
+    bw.put(info.maxFrameSize,24);
+    bw.put(info.sampleRate,20);
+    bw.put(0,3);        // mono
+    bw.put(info.bits - 1,5);
+    bw.put(uint32_t(info.totalSamples >> 32),4);
+    bw.put(uint32_t(info.totalSamples),32);
+    for(int i=0;i<16;i++)
+    {
+        bw.put(0,8);    // no MD5
+    }
+
+    if(seekCapacity==0)
+    {
+        return;
+    }
+
+    bw.put(1,1);
+    bw.put(3,7);        // SEEKTABLE
+    bw.put(uint32_t(seekCapacity * 18),24);
+
+    // Evenly thinned if there are more frames than room
+    const size_t used = std::min(points.size(),seekCapacity);
+
+    for(size_t i=0;i<seekCapacity;i++)
+    {
+        if(i < used)
+        {
+            const SeekPoint & p = points[i * points.size() / used];
+            bw.put(uint32_t(p.sample >> 32),32);
+            bw.put(uint32_t(p.sample),32);
+            bw.put(uint32_t(p.offset >> 32),32);
+            bw.put(uint32_t(p.offset),32);
+            bw.put(p.samples,16);
+        }
+        else
+        {
+            bw.put(0xffffffff,32);  // placeholder
+            bw.put(0xffffffff,32);
+            bw.put(0,32);
+            bw.put(0,32);
+            bw.put(0,16);
+        }
+    }
+}
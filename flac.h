@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Encoder for FLAC streams, mono, fixed block size. Frames are
+// independent, so blocks can be encoded in parallel and written in
+// order afterwards. Each subframe is the smallest of constant,
+// verbatim, fixed predictors of order 0..4 and LPC up to order 8,
+// with Rice coded residuals in up to 2^8 partitions.
+
+class FlacEncoder {
+public:
+    // One SEEKTABLE entry, offsets relative to the first frame
+    struct SeekPoint {
+        uint64_t sample;
+        uint64_t offset;
+        uint16_t samples;
+    };
+
+    struct StreamInfo {
+        uint32_t sampleRate = 44100;
+        int bits = 16;
+        uint32_t blockSize = 4096;
+        uint32_t minFrameSize = 0; // 0 == unknown
+        uint32_t maxFrameSize = 0;
+        uint64_t totalSamples = 0; // 0 == unknown
+    };
+
+    // STREAMINFO stores the rate in 20 bits
+    static const uint32_t maxSampleRate = 1048575;
+
+    FlacEncoder(int bits,uint32_t blockSize=4096);
+
+    // Append frame number frame, holding samples x[0..n), to out
+    void encodeFrame(const int32_t * x,size_t n,uint64_t frame,std::vector<uint8_t> & out) const;
+
+    uint32_t blockSize() const
+    {
+        return _blockSize;
+    }
+
+    // "fLaC", STREAMINFO and a SEEKTABLE of exactly seekCapacity
+    // points. Unused points are placeholders, so the size is fixed
+    // and the header can be rewritten once the stream is complete.
+    static void writeHeader(const StreamInfo & info,const std::vector<SeekPoint> & points,
+                            size_t seekCapacity,std::vector<uint8_t> & out);
+
+private:
+    class BitWriter;
+
+    void encodeSubframe(const int32_t * x,size_t n,BitWriter & bw) const;
+
+    int _bits;
+    uint32_t _blockSize;
+};
@@ -1,4 +1,14 @@
 #include "jobpool.h"
+#include "topology.h"
+
+#include <future>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 JobQueue::JobQueue( int maxsize )
     : _maxsize(maxsize)
@@ -51,6 +61,147 @@ void JobQueue::finish()
     std::unique_lock<decltype (_mtx)> lck(_mtx);
     _finished = true;
     _cnt.notify_all();
+
+    // Waiting poppers only exist on an empty queue, they get nothing
+    while(!_popWaiters.empty())
+    {
+        PopAwaiter * w = _popWaiters.front();
+        _popWaiters.pop_front();
+        w->_result = false;
+        _executor->schedule(w->_h);
+    }
+}
+
+JobQueue::PopAwaiter JobQueue::asyncPop(dataptr_t & job)
+{
+    return PopAwaiter(*this,job);
+}
+
+JobQueue::PushAwaiter JobQueue::asyncPush(dataptr_t job)
+{
+    return PushAwaiter(*this,job);
+}
+
+void JobQueue::setExecutor(JobExecutor * executor)
+{
+    _executor = executor;
+}
+
+JobQueue::PopAwaiter::PopAwaiter(JobQueue & q,dataptr_t & data)
+    : _q(q)
+    , _data(data)
+{
+}
+
+bool JobQueue::PopAwaiter::await_ready()
+{
+    if(!_q._executor)
+    {
+        _result = _q.pop(_data);
+        return true;
+    }
+
+    // Single threaded from here on, no locking
+    if(!_q._jobs.empty())
+    {
+        _data = _q._jobs.front();
+        _q._jobs.pop();
+
+        // Room again, take over the chunk of a waiting pusher
+        if(!_q._pushWaiters.empty())
+        {
+            PushAwaiter * w = _q._pushWaiters.front();
+            _q._pushWaiters.pop_front();
+            _q._jobs.push(w->_data);
+            _q._executor->schedule(w->_h);
+        }
+
+        _result = true;
+        return true;
+    }
+
+    if(_q._finished)
+    {
+        _result = false;
+        return true;
+    }
+
+    return false;
+}
+
+void JobQueue::PopAwaiter::await_suspend(Task::handle_t h)
+{
+    _h = h;
+    _q._popWaiters.push_back(this);
+}
+
+bool JobQueue::PopAwaiter::await_resume()
+{
+    return _result;
+}
+
+JobQueue::PushAwaiter::PushAwaiter(JobQueue & q,dataptr_t data)
+    : _q(q)
+    , _data(data)
+{
+}
+
+bool JobQueue::PushAwaiter::await_ready()
+{
+    if(!_q._executor)
+    {
+        _q.push(_data);
+        return true;
+    }
+
+    if(_q._finished)
+    {
+        throw std::runtime_error("Illegal push on fiished job queue");
+    }
+
+    // Hand over to a waiting popper, the queue is empty then
+    if(!_q._popWaiters.empty())
+    {
+        PopAwaiter * w = _q._popWaiters.front();
+        _q._popWaiters.pop_front();
+        w->_data = _data;
+        w->_result = true;
+        _q._executor->schedule(w->_h);
+        return true;
+    }
+
+    if(_q._maxsize==0 || _q._jobs.size()<size_t(_q._maxsize))
+    {
+        _q._jobs.push(_data);
+        return true;
+    }
+
+    return false;
+}
+
+void JobQueue::PushAwaiter::await_suspend(Task::handle_t h)
+{
+    _h = h;
+    _q._pushWaiters.push_back(this);
+}
+
+void JobQueue::PushAwaiter::await_resume()
+{
+}
+
+JobQueue::dataptr_t JobQueue::alloc(size_t s)
+{
+    return dataptr_t(new Data(s,_node));
+}
+
+void JobQueue::setNode(int node)
+{
+    _node = node;
+}
+
+int JobQueue::node() const
+{
+    return _node;
 }
 
 Job::Job() {
@@ -59,6 +210,26 @@ Job::Job() {
 Job::~Job() {
 }
 
+const std::vector<JobQueue *> & Job::inputs() const
+{
+    return _inputs;
+}
+
+const std::vector<JobQueue *> & Job::outputs() const
+{
+    return _outputs;
+}
+
+void Job::consumes(JobQueue & q)
+{
+    _inputs.push_back(&q);
+}
+
+void Job::produces(JobQueue & q)
+{
+    _outputs.push_back(&q);
+}
+
 
 JobPool::~JobPool()
 {
@@ -82,11 +253,210 @@ void JobPool::addJobs(std::vector<jobptr_t> && queues)
     }
 }
 
+void JobPool::setPlacement(Placement placement,const std::vector<int> & cpus)
+{
+    const CpuTopology & topo = CpuTopology::get();
+
+    if(placement == Placement::List)
+    {
+        if(cpus.empty())
+        {
+            throw std::runtime_error("Empty CPU list");
+        }
+
+        for(int c : cpus)
+        {
+            if(!topo.has(c))
+            {
+                throw std::runtime_error("CPU " + std::to_string(c) + " is not online or not in the affinity mask");
+            }
+        }
+    }
+
+    _placement = placement;
+    _list = cpus;
+}
+
 void JobPool::start() {
-    for(auto & j : _jobs)
+    const CpuTopology & topo = CpuTopology::get();
+
+    std::vector<int> order;
+
+    switch(_placement)
+    {
+    case Placement::None:
+        break;
+    case Placement::Compact:
+        order = topo.compact();
+        break;
+    case Placement::Spread:
+        order = topo.spread();
+        break;
+    case Placement::List:
+        order = _list;
+        break;
+    }
+
+    _cpus.assign(_jobs.size(),-1);
+
+    for(size_t i=0;i<_jobs.size() && !order.empty();i++)
+    {
+        _cpus[i] = order[i % order.size()];
+    }
+
+    // Threads wait until they are pinned, so nothing gets allocated
+    // before the queue nodes are known
+    std::promise<void> go;
+    std::shared_future<void> started = go.get_future().share();
+
+    for(size_t i=0;i<_jobs.size();i++)
     {
-        _threads.push_back(std::thread([j](){
-            while(j->run());
+        jobptr_t j = _jobs[i];
+
+        _threads.push_back(std::thread([j,started](){
+            started.wait();
+            while(j->run().get());
         }));
+
+#ifdef __linux__
+        if(_cpus[i] >= 0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(_cpus[i],&set);
+
+            if(pthread_setaffinity_np(_threads.back().native_handle(),sizeof(set),&set) != 0)
+            {
+                std::cerr << "Failed to pin thread to CPU " << _cpus[i] << std::endl;
+                _cpus[i] = -1;
+            }
+        }
+#else
+        _cpus[i] = -1;
+#endif
+
+        // Chunks a job pops are allocated on its node by the producer.
+        // Only worth it with more than one node.
+        if(_cpus[i] >= 0 && topo.nodes() > 1)
+        {
+            for(JobQueue * q : _jobs[i]->inputs())
+            {
+                q->setNode(topo.node(_cpus[i]));
+            }
+        }
+    }
+
+    go.set_value();
+}
+
+const std::vector<int> & JobPool::cpus() const
+{
+    return _cpus;
+}
+
+void JobPool::writePlacement(std::ostream & os) const
+{
+    const CpuTopology & topo = CpuTopology::get();
+
+    os << "{\"policy\": \"" << placementName(_placement) << "\", \"threads\": [";
+
+    for(size_t i=0;i<_cpus.size();i++)
+    {
+        os << (i ? ", " : "") << "{\"job\": " << i
+           << ", \"cpu\": " << _cpus[i]
+           << ", \"node\": " << (_cpus[i] < 0 ? -1 : topo.node(_cpus[i])) << "}";
+    }
+
+    os << "]}";
+}
+
+std::string JobPool::placementName(Placement placement)
+{
+    switch(placement)
+    {
+    case Placement::None:
+        return "none";
+    case Placement::Compact:
+        return "compact";
+    case Placement::Spread:
+        return "spread";
+    case Placement::List:
+        return "list";
+    }
+    return "";
+}
+
+void JobExecutor::addJobs(std::vector<jobptr_t> && jobs)
+{
+    for(auto & j : jobs)
+    {
+        _jobs.push_back(j);
+    }
+}
+
+void JobExecutor::run()
+{
+    std::vector<Slot> slots(_jobs.size());
+
+    for(size_t i=0;i<_jobs.size();i++)
+    {
+        for(JobQueue * q : _jobs[i]->inputs())
+        {
+            q->setExecutor(this);
+        }
+
+        for(JobQueue * q : _jobs[i]->outputs())
+        {
+            q->setExecutor(this);
+        }
+
+        slots[i].job = _jobs[i];
+    }
+
+    // First step of every job, in pipeline order
+    for(auto & s : slots)
+    {
+        s.task = s.job->run();
+        s.task.handle().promise()._context = &s;
+        _ready.push_back(s.task.handle());
     }
+
+    size_t running = slots.size();
+
+    while(!_ready.empty())
+    {
+        Task::handle_t h = _ready.front();
+        _ready.pop_front();
+
+        h.resume();
+
+        if(!h.done())
+        {
+            // Suspended on a queue, which schedules it again
+            continue;
+        }
+
+        Slot * s = static_cast<Slot *>(h.promise()._context);
+
+        if(s->task.result())
+        {
+            s->task = s->job->run();
+            s->task.handle().promise()._context = s;
+            _ready.push_back(s->task.handle());
+        }
+        else
+        {
+            running--;
+        }
+    }
+
+    if(running > 0)
+    {
+        throw std::runtime_error("Jobs wait on each other, pipeline deadlocked");
+    }
+}
+
+void JobExecutor::schedule(Task::handle_t h)
+{
+    _ready.push_back(h);
 }
@@ -6,6 +6,15 @@
 #include <vector>
 #include <queue>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+
+#include "nodealloc.h"
+#include "task.h"
+
+class JobExecutor;
 
 // Producer/Consumer queue for inter-thread communication
 // of chunks of std::vector<float>
@@ -14,13 +23,50 @@ class JobQueue {
 public:
     struct Data {
     public:
-        Data(size_t s=0)
-            : _vector(s)
+        typedef std::vector<float,NodeAllocator<float>> vector_t;
+        Data(size_t s=0,int node=-1)
+            : _vector(s,0.0f,NodeAllocator<float>(node))
         {
         }
-        std::vector<float> _vector;
+        vector_t _vector;
+        // Position in the stream, for stages that reorder chunks
+        uint64_t _seq = 0;
+        // Encoded form of _vector, e.g. a compressed frame
+        std::vector<uint8_t> _bytes;
     };
     typedef std::shared_ptr<Data> dataptr_t;
+
+    // co_await asyncPop(data) / asyncPush(data) inside Job::run().
+    // Without an executor they block like pop()/push(). Under a
+    // JobExecutor they suspend the job instead and the other side
+    // of the queue hands the chunk over directly when it resumes.
+    class PopAwaiter {
+    public:
+        PopAwaiter(JobQueue & q,dataptr_t & data);
+        bool await_ready();
+        void await_suspend(Task::handle_t h);
+        bool await_resume();
+    private:
+        friend class JobQueue;
+        JobQueue & _q;
+        dataptr_t & _data;
+        Task::handle_t _h;
+        bool _result = false;
+    };
+
+    class PushAwaiter {
+    public:
+        PushAwaiter(JobQueue & q,dataptr_t data);
+        bool await_ready();
+        void await_suspend(Task::handle_t h);
+        void await_resume();
+    private:
+        friend class JobQueue;
+        JobQueue & _q;
+        dataptr_t _data;
+        Task::handle_t _h;
+    };
+
     JobQueue(int maxsize=10);
     virtual
     ~JobQueue();
@@ -28,6 +74,15 @@ public:
     bool pop(dataptr_t & job);
     size_t size();
     void finish();
+    PopAwaiter asyncPop(dataptr_t & job);
+    PushAwaiter asyncPush(dataptr_t job);
+    // Run queue operations as suspension points of executor
+    void setExecutor(JobExecutor * executor);
+    // New chunk for this queue, placed on the consumer's NUMA node
+    dataptr_t alloc(size_t s=0);
+    // NUMA node of the consuming thread, -1 if unknown
+    void setNode(int node);
+    int node() const;
 private:
     std::condition_variable _cnt;
     std::queue<dataptr_t> _jobs;
@@ -35,6 +90,10 @@ private:
     int _maxsize = 0;
     int _count = 0;
     bool _finished = false;
+    int _node = -1;
+    JobExecutor * _executor = nullptr;
+    std::deque<PopAwaiter *> _popWaiters;
+    std::deque<PushAwaiter *> _pushWaiters;
 };
 
 // Virtual base class of a Job in the Job pool
@@ -42,18 +101,68 @@ class Job {
 public:
     Job();
     virtual ~Job();
-    virtual bool run() = 0;
+    // One step, typically one chunk. co_return false when done
+    virtual Task run() = 0;
+    // Queues this job pops from
+    const std::vector<JobQueue *> & inputs() const;
+    // Queues this job pushes to
+    const std::vector<JobQueue *> & outputs() const;
+protected:
+    void consumes(JobQueue & q);
+    void produces(JobQueue & q);
+private:
+    std::vector<JobQueue *> _inputs;
+    std::vector<JobQueue *> _outputs;
 };
 
 // A pool of Jobs meant to be executed in different threads
 class JobPool {
 public:
     typedef std::shared_ptr<Job> jobptr_t;
+
+    // Where the job threads run. Jobs are placed in the order they
+    // were added, so pipeline neighbours get neighbouring CPUs.
+    enum class Placement {
+        None,    // unpinned, the scheduler decides
+        Compact, // sibling cores sharing caches first
+        Spread,  // one core per cache/package/node round robin
+        List     // the explicit CPU list, cycled
+    };
+
     virtual ~JobPool();
     void join();
     void addJobs(std::vector<jobptr_t> && queues);
+    void setPlacement(Placement placement,const std::vector<int> & cpus = {});
     void start();
+    // CPU of each job in start(), -1 when unpinned
+    const std::vector<int> & cpus() const;
+    void writePlacement(std::ostream & os) const;
+    static std::string placementName(Placement placement);
 private:
     std::vector<std::thread> _threads;
     std::vector<jobptr_t> _jobs;
+    Placement _placement = Placement::None;
+    std::vector<int> _list;
+    std::vector<int> _cpus;
+};
+
+// Runs Jobs as coroutines on the calling thread. Queue push/pop
+// are suspension points, so there are no thread hand-offs and no
+// context switches. Cheaper than a JobPool for small inputs.
+class JobExecutor {
+public:
+    typedef std::shared_ptr<Job> jobptr_t;
+
+    void addJobs(std::vector<jobptr_t> && jobs);
+    // Run all jobs until they are done
+    void run();
+    // Resume h in a later turn of run()
+    void schedule(Task::handle_t h);
+private:
+    struct Slot {
+        jobptr_t job;
+        Task task;
+    };
+    std::vector<jobptr_t> _jobs;
+    std::deque<Task::handle_t> _ready;
 };
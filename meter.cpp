@@ -0,0 +1,172 @@
+#include "meter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <stdexcept>
+
+const float ChannelStats::clipLevel = 1.0f;
+
+void ChannelStats::add(const float * x,size_t n,size_t stride)
+{
+    // Eight independent lanes so peak, sums and clip count are
+    // computed in one vectorized pass over the chunk
+    float pk[8] = {0,0,0,0,0,0,0,0};
+    float s[8]  = {0,0,0,0,0,0,0,0};
+    float q[8]  = {0,0,0,0,0,0,0,0};
+    uint32_t c[8] = {0,0,0,0,0,0,0,0};
+
+    size_t i = 0;
+
+    for(;i+8<=n;i+=8)
+    {
+        for(size_t l=0;l<8;l++)
+        {
+            float v = x[(i+l)*stride];
+            float a = std::fabs(v);
+
+            pk[l] = std::max(pk[l],a);
+            s[l] += v;
+            q[l] += v * v;
+            c[l] += a >= clipLevel ? 1 : 0;
+        }
+    }
+
+    for(size_t l=0;i<n;i++,l++)
+    {
+        float v = x[i*stride];
+        float a = std::fabs(v);
+
+        pk[l] = std::max(pk[l],a);
+        s[l] += v;
+        q[l] += v * v;
+        c[l] += a >= clipLevel ? 1 : 0;
+    }
+
+    for(size_t l=0;l<8;l++)
+    {
+        peak        = std::max(peak,pk[l]);
+        sum        += s[l];
+        sumSquares += q[l];
+        clipped    += c[l];
+    }
+
+    truePeak = std::max(truePeak,peak);
+    samples += n;
+}
+
+void ChannelStats::addTruePeak(const float * x,size_t n)
+{
+    float pk[8] = {0,0,0,0,0,0,0,0};
+    size_t i = 0;
+
+    for(;i+8<=n;i+=8)
+    {
+        for(size_t l=0;l<8;l++)
+        {
+            pk[l] = std::max(pk[l],std::fabs(x[i+l]));
+        }
+    }
+
+    for(;i<n;i++)
+    {
+        pk[0] = std::max(pk[0],std::fabs(x[i]));
+    }
+
+    truePeak = std::max(truePeak,*std::max_element(pk,pk+8));
+}
+
+void ChannelStats::merge(const ChannelStats & other)
+{
+    samples    += other.samples;
+    clipped    += other.clipped;
+    peak        = std::max(peak,other.peak);
+    truePeak    = std::max(truePeak,other.truePeak);
+    sum        += other.sum;
+    sumSquares += other.sumSquares;
+}
+
+double ChannelStats::rms() const
+{
+    return samples == 0 ? 0.0 : std::sqrt(sumSquares / double(samples));
+}
+
+double ChannelStats::dcOffset() const
+{
+    return samples == 0 ? 0.0 : sum / double(samples);
+}
+
+Meter::Meter(const std::string & name,int channels)
+    : _name(name)
+    , _channels(channels)
+    , _stats(channels)
+{
+}
+
+void Meter::merge(const std::vector<ChannelStats> & stats)
+{
+    std::unique_lock<decltype (_mtx)> lck(_mtx);
+
+    if(stats.size() != _stats.size())
+    {
+        throw std::runtime_error("Channel count mismatch on meter '" + _name + "'");
+    }
+
+    for(size_t i=0;i<stats.size();i++)
+    {
+        _stats[i].merge(stats[i]);
+    }
+}
+
+std::vector<ChannelStats> Meter::stats()
+{
+    std::unique_lock<decltype (_mtx)> lck(_mtx);
+    return _stats;
+}
+
+namespace {
+    // JSON has no infinity, silence is reported as null
+    struct Db {
+        double v;
+    };
+
+    std::ostream & operator<<(std::ostream & os,const Db & db)
+    {
+        if(db.v <= 0.0)
+        {
+            return os << "null";
+        }
+        return os << 20.0 * std::log10(db.v);
+    }
+}
+
+void Meter::writeJson(std::ostream & os)
+{
+    std::vector<ChannelStats> st = stats();
+
+    os << std::setprecision(9)
+       << "{" << std::endl
+       << "  \"name\": \"" << _name << "\"," << std::endl
+       << "  \"channels\": [" << std::endl;
+
+    for(size_t i=0;i<st.size();i++)
+    {
+        const ChannelStats & s = st[i];
+
+        os << "    {" << std::endl
+           << "      \"channel\": " << i << "," << std::endl
+           << "      \"samples\": " << s.samples << "," << std::endl
+           << "      \"peak\": " << s.peak << "," << std::endl
+           << "      \"peak_dbfs\": " << Db{s.peak} << "," << std::endl
+           << "      \"true_peak\": " << s.truePeak << "," << std::endl
+           << "      \"true_peak_dbtp\": " << Db{s.truePeak} << "," << std::endl
+           << "      \"rms\": " << s.rms() << "," << std::endl
+           << "      \"rms_dbfs\": " << Db{s.rms()} << "," << std::endl
+           << "      \"clipped\": " << s.clipped << "," << std::endl
+           << "      \"dc_offset\": " << s.dcOffset() << std::endl
+           << "    }" << (i+1 < st.size() ? "," : "") << std::endl;
+    }
+
+    os << "  ]" << std::endl
+       << "}" << std::endl;
+}
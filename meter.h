@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Running level statistics of one channel.
+
+struct ChannelStats {
+    // Accumulate n samples x[0], x[stride], ... x[(n-1)*stride]
+    void add(const float * x,size_t n,size_t stride=1);
+
+    // Accumulate the peak of an already oversampled signal
+    void addTruePeak(const float * x,size_t n);
+
+    // Combine the statistics of another part of the same channel
+    void merge(const ChannelStats & other);
+
+    double rms() const;
+    double dcOffset() const;
+
+    uint64_t samples = 0;
+    uint64_t clipped = 0;
+    float peak = 0.0f;
+    float truePeak = 0.0f;
+    double sum = 0.0;
+    double sumSquares = 0.0;
+
+    // Samples at or beyond full scale count as clipped
+    static const float clipLevel;
+};
+
+// Per-channel statistics of one pipeline edge. Several taps
+// (replicas of a parallel stage) may merge into one Meter.
+
+class Meter {
+public:
+    Meter(const std::string & name,int channels=1);
+
+    void merge(const std::vector<ChannelStats> & stats);
+
+    std::vector<ChannelStats> stats();
+
+    void writeJson(std::ostream & os);
+
+    const std::string & name() const
+    {
+        return _name;
+    }
+
+    int channels() const
+    {
+        return _channels;
+    }
+
+private:
+    std::mutex _mtx;
+    std::string _name;
+    int _channels;
+    std::vector<ChannelStats> _stats;
+};
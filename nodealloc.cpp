@@ -0,0 +1,88 @@
+#include "nodealloc.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#endif
+
+namespace {
+    const size_t pageSize = 4096;
+
+    // Cached blocks per node and size, beyond that they are unmapped
+    const size_t maxCached = 1024;
+
+    std::mutex cacheMtx;
+    std::map<std::pair<int,size_t>,std::vector<void *>> cache;
+
+    size_t pages(size_t bytes)
+    {
+        return (std::max<size_t>(bytes,1) + pageSize - 1) / pageSize * pageSize;
+    }
+}
+
+void * NodeMemory::allocate(size_t bytes,int node)
+{
+    const size_t len = pages(bytes);
+
+    {
+        std::unique_lock<decltype (cacheMtx)> lck(cacheMtx);
+        std::vector<void *> & blocks = cache[std::make_pair(node,len)];
+
+        if(!blocks.empty())
+        {
+            void * p = blocks.back();
+            blocks.pop_back();
+            return p;
+        }
+    }
+
+#ifdef __linux__
+    void * p = ::mmap(nullptr,len,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+
+    if(p == MAP_FAILED)
+    {
+        throw std::bad_alloc();
+    }
+
+    // Preferred, not bound: a full node falls back to the others.
+    // Pages are placed when first touched, which is after this call.
+    if(node < int(8 * sizeof(unsigned long)))
+    {
+        unsigned long mask = 1UL << node;
+        ::syscall(SYS_mbind,p,len,MPOL_PREFERRED,&mask,8 * sizeof(mask) + 1,0);
+    }
+
+    return p;
+#else
+    return ::operator new(len);
+#endif
+}
+
+void NodeMemory::release(void * p,size_t bytes,int node)
+{
+    const size_t len = pages(bytes);
+
+    {
+        std::unique_lock<decltype (cacheMtx)> lck(cacheMtx);
+        std::vector<void *> & blocks = cache[std::make_pair(node,len)];
+
+        if(blocks.size() < maxCached)
+        {
+            blocks.push_back(p);
+            return;
+        }
+    }
+
+#ifdef __linux__
+    ::munmap(p,len);
+#else
+    ::operator delete(p);
+#endif
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+// Page granular memory preferably placed on one NUMA node.
+// Released blocks are kept per node and size for reuse, chunk
+// sizes in the pipeline repeat so most allocations hit the cache.
+
+class NodeMemory {
+public:
+    static void * allocate(size_t bytes,int node);
+    static void release(void * p,size_t bytes,int node);
+};
+
+// Allocator for containers handed to a consumer on another thread.
+// node < 0 is the plain heap.
+
+template<class T>
+class NodeAllocator {
+public:
+    typedef T value_type;
+
+    NodeAllocator(int node=-1)
+        : _node(node)
+    {
+    }
+
+    template<class U>
+    NodeAllocator(const NodeAllocator<U> & other)
+        : _node(other.node())
+    {
+    }
+
+    T * allocate(size_t n)
+    {
+        if(_node < 0)
+        {
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T *>(NodeMemory::allocate(n * sizeof(T),_node));
+    }
+
+    void deallocate(T * p,size_t n)
+    {
+        if(_node < 0)
+        {
+            ::operator delete(p);
+            return;
+        }
+        NodeMemory::release(p,n * sizeof(T),_node);
+    }
+
+    int node() const
+    {
+        return _node;
+    }
+
+    template<class U>
+    bool operator==(const NodeAllocator<U> & other) const
+    {
+        return _node == other.node();
+    }
+
+    template<class U>
+    bool operator!=(const NodeAllocator<U> & other) const
+    {
+        return _node != other.node();
+    }
+
+private:
+    int _node;
+};
@@ -0,0 +1,238 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+#include "resampler.h"
+
+// Reference converter: evaluates a Kaiser windowed sinc for every
+// tap of every output sample. No tables, no polyphase decomposition.
+
+class NaiveResampler {
+public:
+    NaiveResampler(uint32_t inRate,uint32_t outRate,size_t taps=32)
+        : _step(double(inRate) / double(outRate))
+        , _half(taps / 2)
+        , _fc(0.92 * std::min(1.0,double(outRate) / double(inRate)))
+    {
+    }
+
+    void process(const std::vector<float> & in,std::vector<float> & out)
+    {
+        const double hw = double(_half);
+
+        for(double t=0.0;t<double(in.size());t+=_step)
+        {
+            long c = long(std::floor(t));
+            double acc = 0.0;
+
+            for(long k=c-long(_half)+1;k<=c+long(_half);k++)
+            {
+                if(k<0 || k>=long(in.size()))
+                {
+                    continue;
+                }
+
+                double x = t - double(k);
+                double s = x == 0.0 ? 1.0 : std::sin(M_PI * _fc * x) / (M_PI * _fc * x);
+                double r = x / hw;
+                double w = r*r < 1.0 ? bessel0(8.0 * std::sqrt(1.0 - r * r)) / bessel0(8.0) : 0.0;
+
+                acc += in[k] * _fc * s * w;
+            }
+
+            out.push_back(float(acc));
+        }
+    }
+
+private:
+    static double bessel0(double x)
+    {
+        double sum = 1.0, term = 1.0, y = x * x / 4.0;
+
+        for(int k=1;k<64 && term > sum * 1e-12;k++)
+        {
+            term *= y / (double(k) * double(k));
+            sum  += term;
+        }
+        return sum;
+    }
+
+    double _step;
+    size_t _half;
+    double _fc;
+};
+
+// Error of out against the ideal sine, ignoring the edges
+static double errorDb(const std::vector<float> & out,uint32_t rate,double freq)
+{
+    double sig = 0.0;
+    double err = 0.0;
+
+    for(size_t i=out.size()/10;i<out.size()*9/10;i++)
+    {
+        double ref = 0.5 * std::sin(2.0 * M_PI * freq * double(i) / double(rate));
+        sig += ref * ref;
+        err += (out[i] - ref) * (out[i] - ref);
+    }
+
+    return 10.0 * std::log10(err / sig);
+}
+
+// Level of the freq component of out relative to amplitude 0.5, dB
+static double toneDb(const std::vector<float> & out,uint32_t rate,double freq)
+{
+    double re = 0.0;
+    double im = 0.0;
+    size_t n = 0;
+
+    for(size_t i=out.size()/10;i<out.size()*9/10;i++,n++)
+    {
+        double a = 2.0 * M_PI * freq * double(i) / double(rate);
+        re += out[i] * std::cos(a);
+        im += out[i] * std::sin(a);
+    }
+
+    double amp = 2.0 * std::sqrt(re * re + im * im) / double(n);
+
+    return 20.0 * std::log10(std::max(amp,1e-12) / 0.5);
+}
+
+// Frequency f shows up at after sampling at rate
+static double fold(double f,uint32_t rate)
+{
+    f = std::fmod(f,double(rate));
+    return f > rate / 2.0 ? double(rate) - f : f;
+}
+
+// A whole second of a 0.5 sine at freq through a fresh converter
+static std::vector<float> convert(uint32_t inRate,uint32_t outRate,double freq)
+{
+    std::vector<float> in(inRate);
+    std::vector<float> out;
+
+    for(size_t i=0;i<in.size();i++)
+    {
+        in[i] = float(0.5 * std::sin(2.0 * M_PI * freq * double(i) / double(inRate)));
+    }
+
+    Resampler rs(inRate,outRate);
+    rs.process(in.data(),in.size(),out);
+    rs.flush(out);
+    return out;
+}
+
+// Pass band droop at 0.9 of the lower Nyquist frequency (~20kHz for
+// 44.1kHz) and the level of what aliases or images back from just
+// above it, both in dB
+static void quality(uint32_t inRate,uint32_t outRate,double & droop,double & alias)
+{
+    const double nyquist = std::min(inRate,outRate) / 2.0;
+
+    droop = toneDb(convert(inRate,outRate,0.9 * nyquist),outRate,0.9 * nyquist);
+
+    if(outRate < inRate)
+    {
+        // Input above the output Nyquist frequency folds back
+        double f = 1.05 * nyquist;
+        alias = toneDb(convert(inRate,outRate,f),outRate,fold(f,outRate));
+    }
+    else
+    {
+        // The image of the input mirrored at the input Nyquist frequency
+        double f = 0.95 * nyquist;
+        alias = toneDb(convert(inRate,outRate,f),outRate,fold(double(inRate) - f,outRate));
+    }
+}
+
+static void bench(uint32_t inRate,uint32_t outRate,size_t seconds)
+{
+    typedef std::chrono::steady_clock clock_t;
+
+    const double freq = 1000.0;
+    const size_t chunkSize = 1000;
+
+    std::vector<float> in(size_t(inRate) * seconds);
+
+    for(size_t i=0;i<in.size();i++)
+    {
+        in[i] = float(0.5 * std::sin(2.0 * M_PI * freq * double(i) / double(inRate)));
+    }
+
+    // Polyphase, fed in pipeline sized chunks
+    Resampler rs(inRate,outRate);
+    std::vector<float> poly;
+    poly.reserve(in.size() * outRate / inRate + 1);
+
+    auto t0 = clock_t::now();
+
+    for(size_t i=0;i<in.size();i+=chunkSize)
+    {
+        rs.process(in.data() + i,std::min(chunkSize,in.size() - i),poly);
+    }
+    rs.flush(poly);
+
+    auto t1 = clock_t::now();
+
+    NaiveResampler nrs(inRate,outRate,rs.taps());
+    std::vector<float> naive;
+    naive.reserve(in.size() * outRate / inRate + 1);
+
+    nrs.process(in,naive);
+
+    auto t2 = clock_t::now();
+
+    double tPoly  = std::chrono::duration<double>(t1 - t0).count();
+    double tNaive = std::chrono::duration<double>(t2 - t1).count();
+
+    double droop;
+    double alias;
+
+    quality(inRate,outRate,droop,alias);
+
+    std::cout << std::setw(6) << inRate << " -> " << std::setw(6) << outRate
+              << " L/M " << rs.up() << "/" << rs.down()
+              << std::fixed << std::setprecision(1)
+              << " polyphase " << std::setw(8) << double(in.size()) / tPoly / 1e6 << " MS/s"
+              << " " << std::setw(6) << errorDb(poly,outRate,freq) << " dB"
+              << " naive " << std::setw(6) << double(in.size()) / tNaive / 1e6 << " MS/s"
+              << " " << std::setw(6) << errorDb(naive,outRate,freq) << " dB"
+              << " speedup " << tNaive / tPoly << "x"
+              << std::setprecision(2)
+              << " droop@0.9fn " << droop << " dB"
+              << std::setprecision(1)
+              << " alias " << alias << " dB"
+              << std::defaultfloat << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    size_t seconds = 10;
+
+    if(argc!=1 && argc!=2)
+    {
+        std::cerr << "Usage: " << argv[0] << " [seconds] of audio per ratio" << std::endl;
+        ::exit(1);
+    }
+
+    if(argc==2)
+    {
+        std::stringstream ss(argv[1]);
+
+        if( !(ss >> seconds) || !(ss >> std::ws).eof() || seconds == 0 )
+        {
+            std::cerr << argv[1] << " does't seem to be a positive number" << std::endl;
+            ::exit(2);
+        }
+    }
+
+    bench(48000,44100,seconds);
+    bench(44100,48000,seconds);
+    bench(96000,44100,seconds);
+    bench(44100,22050,seconds);
+    bench(22050,44100,seconds);
+    bench(8000,44100,seconds);
+}
@@ -0,0 +1,169 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    // Upper limit of filter phases, keeps the bank within a few 100k
+    const size_t maxPhases = 4096;
+
+    // Kaiser window shape and the stop band attenuation it gives, dB
+    const double kaiserBeta = 10.0;
+    const double attenuation = kaiserBeta / 0.1102 + 8.7;
+
+    // Lowest cutoff relative to the lower rate, for very short filters
+    const double minCutoff = 0.25;
+}
+
+Resampler::Resampler(uint32_t inRate,uint32_t outRate,size_t taps)
+    : _inRate(inRate)
+    , _outRate(outRate)
+{
+    if(inRate==0 || outRate==0)
+    {
+        throw std::runtime_error("Sample rates have to be positive");
+    }
+
+    uint32_t g = std::gcd(inRate,outRate);
+
+    _up   = outRate / g;
+    _down = inRate  / g;
+
+    if(_up > maxPhases)
+    {
+        std::stringstream ss;
+        ss << "Ratio " << outRate << "/" << inRate << " needs " << _up
+           << " filter phases, only " << maxPhases << " supported";
+        throw std::runtime_error(ss.str());
+    }
+
+    // taps counts samples of the lower rate. Downsampling needs
+    // down/up times as many inputs per output to cover as much time.
+    // Multiple of 8 so every phase fills whole SIMD registers.
+    taps = std::max<size_t>(taps,8);
+    if(_down > _up)
+    {
+        taps = (taps * _down + _up - 1) / _up;
+    }
+    _taps = (taps + 7) & ~size_t(7);
+
+    const size_t len = _up * _taps;
+
+    // Transition band the window achieves over the filter length, in
+    // cycles per sample of the lower rate. It ends at the lower Nyquist
+    // frequency so nothing above it aliases back.
+    const double span  = double(len) / double(std::max(_up,_down));
+    const double width = (attenuation - 8.0) / (2.285 * 2.0 * M_PI * span);
+    const double fc    = std::max(minCutoff,0.5 - 0.5 * width) / double(std::max(_up,_down));
+    // Integer centre, so the filter delay is a whole number of
+    // upsampled samples and can be skipped exactly
+    const size_t mid = len / 2;
+    const double norm = bessel0(kaiserBeta);
+
+    _bank.resize(len);
+
+    for(size_t j=0;j<len;j++)
+    {
+        double x = double(j) - double(mid);
+        double s = x == 0.0 ? 1.0 : std::sin(2.0 * M_PI * fc * x) / (2.0 * M_PI * fc * x);
+        double r = x / double(mid);
+        double w = bessel0(kaiserBeta * std::sqrt(std::max(0.0,1.0 - r * r))) / norm;
+
+        // Coefficient h[j] belongs to phase j % up, tap j / up. Taps
+        // are stored reversed to run forward over the history.
+        size_t p = j % _up;
+        size_t k = j / _up;
+
+        _bank[p * _taps + (_taps - 1 - k)] = float(2.0 * fc * s * w * double(_up));
+    }
+
+    // First output sits at upsampled time mid, which lines it up
+    // with the first input sample
+    _history.assign(_taps - 1,0.0f);
+    _pos   = _taps - 1 + mid / _up;
+    _phase = mid % _up;
+}
+
+void Resampler::process(const float * in,size_t n,std::vector<float> & out)
+{
+    _history.insert(_history.end(),in,in+n);
+    _samplesIn += n;
+
+    while(_pos < _history.size())
+    {
+        const float * h = _bank.data() + _phase * _taps;
+        const float * x = _history.data() + _pos + 1 - _taps;
+
+        // Eight independent partial sums, one per SIMD lane. A single
+        // accumulator would pin the loop to strict in order adds.
+        float lane[8] = {0,0,0,0,0,0,0,0};
+
+        for(size_t k=0;k<_taps;k+=8)
+        {
+            for(size_t l=0;l<8;l++)
+            {
+                lane[l] += h[k+l] * x[k+l];
+            }
+        }
+
+        float acc = ((lane[0] + lane[4]) + (lane[1] + lane[5]))
+                  + ((lane[2] + lane[6]) + (lane[3] + lane[7]));
+
+        out.push_back(acc);
+        _samplesOut++;
+
+        _phase += _down;
+        _pos   += _phase / _up;
+        _phase %= _up;
+    }
+
+    // Keep the last _taps-1 samples the next window still needs
+    size_t drop = std::min(_pos + 1 - _taps,_history.size());
+
+    _history.erase(_history.begin(),_history.begin() + drop);
+    _pos -= drop;
+}
+
+void Resampler::flush(std::vector<float> & out)
+{
+    // Total number of output samples the consumed input stands for
+    const uint64_t expected = (uint64_t(_samplesIn) * _up + _down - 1) / _down;
+
+    const std::vector<float> zeros(_taps,0.0f);
+
+    // The delay spans about _taps/2 inputs plus one output period
+    for(size_t fed=0;_samplesOut < expected && fed < 2 * (_taps + _down);fed+=zeros.size())
+    {
+        uint64_t in = _samplesIn;
+
+        process(zeros.data(),zeros.size(),out);
+
+        // Padding isn't part of the stream
+        _samplesIn = in;
+    }
+
+    if(_samplesOut > expected)
+    {
+        out.resize(out.size() - size_t(_samplesOut - expected));
+        _samplesOut = expected;
+    }
+}
+
+double Resampler::bessel0(double x)
+{
+    // Power series of the modified Bessel function I0
+    double sum  = 1.0;
+    double term = 1.0;
+    double y    = x * x / 4.0;
+
+    for(int k=1;k<64 && term > sum * 1e-12;k++)
+    {
+        term *= y / (double(k) * double(k));
+        sum  += term;
+    }
+
+    return sum;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Polyphase FIR sample rate converter for rational ratios
+// inRate/outRate (e.g. 48000 -> 44100 == 147/160).
+//
+// The prototype low pass is split into _up phases of _taps
+// coefficients each. Every phase is stored reversed and
+// contiguous so that one output sample is a plain dot product
+// over the input history, which the compiler vectorizes.
+//
+// taps is the filter length in samples of the lower of the two
+// rates. The default puts the transition band of 44.1/48kHz
+// conversions between 20kHz and the lower Nyquist frequency with
+// ~100dB stop band attenuation. Shorter filters trade a lower
+// cutoff for speed.
+//
+// One instance handles one channel. It keeps its input history
+// and phase between calls to process() so a stream may be fed
+// in chunks of arbitrary size.
+
+class Resampler {
+public:
+    Resampler(uint32_t inRate,uint32_t outRate,size_t taps=192);
+
+    // Append the converted samples of in[0..n) to out
+    void process(const float * in,size_t n,std::vector<float> & out);
+
+    // Drain the filter delay at end of stream
+    void flush(std::vector<float> & out);
+
+    uint32_t inRate() const
+    {
+        return _inRate;
+    }
+
+    uint32_t outRate() const
+    {
+        return _outRate;
+    }
+
+    size_t up() const
+    {
+        return _up;
+    }
+
+    size_t down() const
+    {
+        return _down;
+    }
+
+    size_t taps() const
+    {
+        return _taps;
+    }
+
+private:
+    static double bessel0(double x);
+
+    uint32_t _inRate;
+    uint32_t _outRate;
+    size_t _up;
+    size_t _down;
+    size_t _taps;
+    std::vector<float> _bank;    // _up phases of _taps coefficients
+    std::vector<float> _history; // input samples not consumed yet
+    size_t _pos;                 // newest input sample of the current window
+    size_t _phase = 0;           // current phase 0 <= _phase < _up
+    uint64_t _samplesIn = 0;
+    uint64_t _samplesOut = 0;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+
+// One step of a Job as a coroutine, co_returns whether the job
+// wants to run again. It starts suspended and suspends at the end
+// so the runner picks up the result.
+//
+// Under a JobPool queue operations block and a step completes in a
+// single resume. Under a JobExecutor it suspends on full/empty
+// queues and is resumed by the executor.
+
+class Task {
+public:
+    struct promise_type {
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_value(bool value)
+        {
+            _value = value;
+        }
+
+        void unhandled_exception()
+        {
+            _error = std::current_exception();
+        }
+
+        bool _value = false;
+        std::exception_ptr _error;
+        void * _context = nullptr; // owned by whoever resumes the task
+    };
+
+    typedef std::coroutine_handle<promise_type> handle_t;
+
+    Task() = default;
+
+    Task(Task && other)
+        : _h(std::exchange(other._h,nullptr))
+    {
+    }
+
+    Task & operator=(Task && other)
+    {
+        if(this != &other)
+        {
+            if(_h)
+            {
+                _h.destroy();
+            }
+            _h = std::exchange(other._h,nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task & operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        if(_h)
+        {
+            _h.destroy();
+        }
+    }
+
+    handle_t handle() const
+    {
+        return _h;
+    }
+
+    // Result of a finished step, rethrows what the step threw
+    bool result() const
+    {
+        if(_h.promise()._error)
+        {
+            std::rethrow_exception(_h.promise()._error);
+        }
+        return _h.promise()._value;
+    }
+
+    // Run the step to its end on the calling thread
+    bool get()
+    {
+        _h.resume();
+
+        if(!_h.done())
+        {
+            throw std::runtime_error("Task suspended outside of an executor");
+        }
+
+        return result();
+    }
+
+private:
+    explicit Task(handle_t h)
+        : _h(h)
+    {
+    }
+
+    handle_t _h;
+};
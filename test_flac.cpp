@@ -0,0 +1,668 @@
+#include <iostream>
+#include <iomanip>
+
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "flac.h"
+#include "wavjobs.h"
+
+// Test of the FLAC encoder and the parallel FLAC output jobs
+//
+// 1 Encodes signals that favour each subframe type (constant, verbatim,
+//   fixed, LPC, RICE2 residuals) at 8/16/24 bits and several block sizes,
+//   with a last block shorter than the block size
+// 2 Decodes the stream again with the independent decoder below, checking
+//   CRCs, STREAMINFO and the round trip against the input
+// 3 Checks that every seek point lands on the sync code of the frame it
+//   names
+// 4 Runs BlockJob -> FlacEncodeJob x 3 -> FlacWriteJob on more frames than
+//   the seek table holds and checks the thinned table
+
+namespace {
+
+void check(bool ok,const std::string & what)
+{
+    if(!ok)
+    {
+        throw std::runtime_error(what);
+    }
+}
+
+class BitReader {
+public:
+    BitReader(const std::vector<uint8_t> & d,size_t pos)
+        : _d(d)
+        , _bit(pos * 8)
+    {
+    }
+
+    uint32_t get(int n)
+    {
+        uint32_t v = 0;
+        for(int i=0;i<n;i++)
+        {
+            check(_bit / 8 < _d.size(),"read past end of stream");
+            v = (v << 1) | ((_d[_bit / 8] >> (7 - _bit % 8)) & 1);
+            _bit++;
+        }
+        return v;
+    }
+
+    int32_t getSigned(int n)
+    {
+        uint32_t v = get(n);
+        return n > 0 && n < 32 && (v >> (n - 1)) ? int32_t(v) - (int32_t(1) << (n - 1)) * 2 : int32_t(v);
+    }
+
+    uint32_t unary()
+    {
+        uint32_t q = 0;
+        while(get(1)==0)
+        {
+            q++;
+        }
+        return q;
+    }
+
+    void align()
+    {
+        _bit = (_bit + 7) & ~size_t(7);
+    }
+
+    size_t pos() const
+    {
+        return _bit / 8;
+    }
+
+private:
+    const std::vector<uint8_t> & _d;
+    size_t _bit;
+};
+
+uint8_t crc8(const uint8_t * p,size_t n)
+{
+    uint8_t c = 0;
+    for(size_t i=0;i<n;i++)
+    {
+        c ^= p[i];
+        for(int j=0;j<8;j++)
+        {
+            c = (c & 0x80) ? uint8_t((c << 1) ^ 0x07) : uint8_t(c << 1);
+        }
+    }
+    return c;
+}
+
+uint16_t crc16(const uint8_t * p,size_t n)
+{
+    uint16_t c = 0;
+    for(size_t i=0;i<n;i++)
+    {
+        c ^= uint16_t(p[i] << 8);
+        for(int j=0;j<8;j++)
+        {
+            c = (c & 0x8000) ? uint16_t((c << 1) ^ 0x8005) : uint16_t(c << 1);
+        }
+    }
+    return c;
+}
+
+struct Decoded {
+    uint32_t minBlock = 0;
+    uint32_t maxBlock = 0;
+    uint32_t minFrame = 0;
+    uint32_t maxFrame = 0;
+    uint32_t sampleRate = 0;
+    int bits = 0;
+    uint64_t total = 0;
+    std::vector<FlacEncoder::SeekPoint> seek; // placeholders dropped
+    size_t seekSize = 0;                      // including placeholders
+    size_t firstFrame = 0;                    // byte offset
+    std::vector<size_t> frames;               // offsets relative to firstFrame
+    std::vector<uint32_t> frameSizes;
+    std::vector<int32_t> samples;
+    std::map<std::string,size_t> types;       // subframe and residual kinds seen
+};
+
+void residual(BitReader & br,size_t n,int order,std::vector<int32_t> & res,Decoded & d)
+{
+    uint32_t method = br.get(2);
+    check(method <= 1,"reserved residual coding method");
+
+    const int paramBits = method==0 ? 4 : 5;
+    const uint32_t escape = (1u << paramBits) - 1;
+    const uint32_t po = br.get(4);
+
+    d.types[method==0 ? "rice" : "rice2"]++;
+
+    res.clear();
+
+    for(size_t p=0;p<(size_t(1) << po);p++)
+    {
+        uint32_t k = br.get(paramBits);
+        check(k!=escape,"unexpected escaped partition");
+
+        size_t cnt = (n >> po) - (p==0 ? order : 0);
+        for(size_t i=0;i<cnt;i++)
+        {
+            uint32_t u = (br.unary() << k) | br.get(k);
+            res.push_back(int32_t(u >> 1) ^ -int32_t(u & 1));
+        }
+    }
+}
+
+Decoded decode(const std::vector<uint8_t> & s)
+{
+    Decoded d;
+
+    check(s.size() > 4 && std::string(s.begin(),s.begin() + 4)=="fLaC","missing fLaC marker");
+
+    size_t pos = 4;
+    bool last = false;
+
+    while(!last)
+    {
+        BitReader br(s,pos);
+        last = br.get(1)!=0;
+        uint32_t type = br.get(7);
+        uint32_t len = br.get(24);
+
+        if(type==0)
+        {
+            d.minBlock = br.get(16);
+            d.maxBlock = br.get(16);
+            d.minFrame = br.get(24);
+            d.maxFrame = br.get(24);
+            d.sampleRate = br.get(20);
+            check(br.get(3)==0,"expected mono");
+            d.bits = int(br.get(5)) + 1;
+            d.total = uint64_t(br.get(4)) << 32;
+            d.total |= br.get(32);
+        }
+        else if(type==3)
+        {
+            d.seekSize = len / 18;
+            for(size_t i=0;i<d.seekSize;i++)
+            {
+                FlacEncoder::SeekPoint p;
+                p.sample = uint64_t(br.get(32)) << 32;
+                p.sample |= br.get(32);
+                p.offset = uint64_t(br.get(32)) << 32;
+                p.offset |= br.get(32);
+                p.samples = uint16_t(br.get(16));
+                if(p.sample != ~uint64_t(0))
+                {
+                    d.seek.push_back(p);
+                }
+            }
+        }
+        pos += 4 + len;
+    }
+
+    d.firstFrame = pos;
+
+    std::vector<int32_t> res;
+
+    while(pos < s.size())
+    {
+        const size_t start = pos;
+        BitReader br(s,pos);
+
+        check(br.get(14)==0x3ffe,"lost frame sync");
+        br.get(1);
+        check(br.get(1)==0,"expected fixed block size");
+
+        uint32_t bsCode = br.get(4);
+        check(br.get(4)==0,"expected sample rate from STREAMINFO");
+        check(br.get(4)==0,"expected mono");
+        br.get(3);
+        br.get(1);
+
+        // UTF-8 coded frame number
+        uint32_t b0 = br.get(8);
+        int len = 0;
+        while(len < 8 && (b0 & (0x80 >> len)))
+        {
+            len++;
+        }
+        uint64_t frame = b0 & (len==0 ? 0x7f : 0x7f >> len);
+        for(int i=1;i<len;i++)
+        {
+            frame = (frame << 6) | (br.get(8) & 0x3f);
+        }
+        check(frame==d.frames.size(),"frame numbers out of order");
+
+        size_t n;
+        if(bsCode==6)
+        {
+            n = br.get(8) + 1;
+        }
+        else if(bsCode==7)
+        {
+            n = br.get(16) + 1;
+        }
+        else if(bsCode==1)
+        {
+            n = 192;
+        }
+        else if(bsCode>=2 && bsCode<=5)
+        {
+            n = size_t(576) << (bsCode - 2);
+        }
+        else
+        {
+            n = size_t(256) << (bsCode - 8);
+        }
+
+        size_t hdr = br.pos();
+        check(crc8(s.data() + start,hdr - start)==br.get(8),"frame header CRC");
+
+        br.get(1);
+        uint32_t type = br.get(6);
+        check(br.get(1)==0,"unexpected wasted bits");
+
+        std::vector<int32_t> x;
+
+        if(type==0)
+        {
+            x.assign(n,br.getSigned(d.bits));
+            d.types["constant"]++;
+        }
+        else if(type==1)
+        {
+            for(size_t i=0;i<n;i++)
+            {
+                x.push_back(br.getSigned(d.bits));
+            }
+            d.types["verbatim"]++;
+        }
+        else if(type>=8 && type<=12)
+        {
+            static const int64_t fixed[5][4] = {{0,0,0,0},{1,0,0,0},{2,-1,0,0},{3,-3,1,0},{4,-6,4,-1}};
+            int order = int(type - 8);
+
+            for(int i=0;i<order;i++)
+            {
+                x.push_back(br.getSigned(d.bits));
+            }
+            residual(br,n,order,res,d);
+            for(int32_t e : res)
+            {
+                int64_t p = 0;
+                for(int j=0;j<order;j++)
+                {
+                    p += fixed[order][j] * x[x.size() - 1 - j];
+                }
+                x.push_back(int32_t(p + e));
+            }
+            d.types["fixed"]++;
+        }
+        else if(type>=32)
+        {
+            int order = int(type - 31);
+
+            for(int i=0;i<order;i++)
+            {
+                x.push_back(br.getSigned(d.bits));
+            }
+            int precision = int(br.get(4)) + 1;
+            int shift = br.getSigned(5);
+            check(shift >= 0,"negative LPC shift");
+
+            std::vector<int32_t> q;
+            for(int i=0;i<order;i++)
+            {
+                q.push_back(br.getSigned(precision));
+            }
+            residual(br,n,order,res,d);
+            for(int32_t e : res)
+            {
+                int64_t p = 0;
+                for(int j=0;j<order;j++)
+                {
+                    p += int64_t(q[j]) * x[x.size() - 1 - j];
+                }
+                x.push_back(int32_t((p >> shift) + e));
+            }
+            d.types["lpc"]++;
+        }
+        else
+        {
+            throw std::runtime_error("reserved subframe type");
+        }
+
+        check(x.size()==n,"subframe length");
+
+        br.align();
+        size_t end = br.pos();
+        check(crc16(s.data() + start,end - start)==br.get(16),"frame CRC");
+
+        d.frames.push_back(start - d.firstFrame);
+        d.frameSizes.push_back(uint32_t(end + 2 - start));
+        d.samples.insert(d.samples.end(),x.begin(),x.end());
+        pos = end + 2;
+    }
+
+    return d;
+}
+
+// Seek points sit on frame starts and describe them
+void checkSeekTable(const Decoded & d,const std::vector<uint8_t> & s,uint32_t blockSize)
+{
+    uint64_t prev = 0;
+
+    for(size_t i=0;i<d.seek.size();i++)
+    {
+        const FlacEncoder::SeekPoint & p = d.seek[i];
+        const size_t at = d.firstFrame + p.offset;
+
+        check(i==0 || p.sample > prev,"seek points not ascending");
+        prev = p.sample;
+
+        check(at + 1 < s.size() && s[at]==0xff && (s[at+1] & 0xfe)==0xf8,"seek point off a frame sync code");
+        check(p.sample % blockSize==0,"seek point sample not on a block");
+
+        size_t frame = size_t(p.sample / blockSize);
+        check(frame < d.frames.size() && d.frames[frame]==p.offset,"seek point offset of the wrong frame");
+        check(p.samples==std::min<uint64_t>(blockSize,d.total - p.sample),"seek point frame length");
+    }
+}
+
+// Tones plus noise, with runs that favour the other subframe types
+std::vector<int32_t> signal(int bits,size_t n,std::mt19937 & rng)
+{
+    const double full = double((int64_t(1) << (bits - 1)) - 1);
+    std::uniform_real_distribution<> noise(-1.0,1.0);
+    std::vector<int32_t> x(n);
+
+    for(size_t i=0;i<n;i++)
+    {
+        double v;
+        switch((i / 3000) % 5)
+        {
+        case 0: v = 0.25; break;                                       // constant
+        case 1: v = noise(rng); break;                                 // verbatim
+        case 2: v = -0.9 + 1.8 * double(i % 3000) / 3000.0; break;     // fixed
+        case 3: v = 0.5 * std::sin(0.05 * i) + 0.3 * std::sin(0.31 * i); break; // LPC
+        default: v = 0.6 * std::sin(0.02 * i) + 0.3 * noise(rng); break; // large residuals
+        }
+        x[i] = int32_t(std::lround(std::max(-1.0,std::min(1.0,v)) * full));
+    }
+
+    return x;
+}
+
+void testRoundTrip(std::map<std::string,size_t> & seen,std::mt19937 & rng)
+{
+    for(int bits : {8,16,24})
+    {
+        for(uint32_t blockSize : {192u,1152u,4096u,1000u})
+        {
+            // Last frame shorter than the others
+            const size_t total = 15 * 3000 + blockSize / 3 + 1;
+            std::vector<int32_t> x = signal(bits,total,rng);
+            FlacEncoder encoder(bits,blockSize);
+            std::vector<uint8_t> frames;
+            std::vector<FlacEncoder::SeekPoint> points;
+            FlacEncoder::StreamInfo info;
+
+            info.sampleRate = 48000;
+            info.bits = bits;
+            info.blockSize = blockSize;
+
+            for(size_t i=0,f=0;i<total;i+=blockSize,f++)
+            {
+                size_t n = std::min<size_t>(blockSize,total - i);
+                size_t before = frames.size();
+
+                points.push_back({i,before,uint16_t(n)});
+                encoder.encodeFrame(x.data() + i,n,f,frames);
+
+                uint32_t size = uint32_t(frames.size() - before);
+                info.minFrameSize = f==0 ? size : std::min(info.minFrameSize,size);
+                info.maxFrameSize = std::max(info.maxFrameSize,size);
+            }
+            info.totalSamples = total;
+
+            std::vector<uint8_t> s;
+            FlacEncoder::writeHeader(info,points,points.size(),s);
+            s.insert(s.end(),frames.begin(),frames.end());
+
+            Decoded d = decode(s);
+
+            std::stringstream ss;
+            ss << bits << " bits, block " << blockSize << ": ";
+
+            check(d.bits==bits && d.sampleRate==48000 && d.total==total,ss.str() + "STREAMINFO");
+            check(d.minBlock==blockSize && d.maxBlock==blockSize,ss.str() + "STREAMINFO block size");
+            check(d.minFrame==*std::min_element(d.frameSizes.begin(),d.frameSizes.end()) &&
+                  d.maxFrame==*std::max_element(d.frameSizes.begin(),d.frameSizes.end()),ss.str() + "STREAMINFO frame size");
+            check(d.samples==x,ss.str() + "round trip");
+            check(d.seek.size()==points.size(),ss.str() + "seek table size");
+            checkSeekTable(d,s,blockSize);
+
+            for(auto & t : d.types)
+            {
+                seen[t.first] += t.second;
+            }
+
+            std::cout << std::setw(2) << bits << " bits block " << std::setw(4) << blockSize
+                      << " frames " << std::setw(3) << d.frames.size()
+                      << " ratio " << std::fixed << std::setprecision(3)
+                      << double(s.size()) / double(total * bits / 8) << std::endl;
+        }
+    }
+}
+
+// In memory file
+class MemorySink : public ByteSink {
+public:
+    MemorySink(std::vector<uint8_t> & data)
+        : _data(data)
+    {
+    }
+
+    size_t maxChunk() const override
+    {
+        return 4096;
+    }
+
+    uint8_t * buffer(size_t n) override
+    {
+        _buff.resize(n);
+        return _buff.data();
+    }
+
+    bool commit(size_t n) override
+    {
+        _data.insert(_data.end(),_buff.begin(),_buff.begin() + n);
+        return true;
+    }
+
+    bool writeAt(uint64_t offset,const uint8_t * data,size_t n) override
+    {
+        std::copy(data,data + n,_data.begin() + offset);
+        return true;
+    }
+
+    bool good() const override
+    {
+        return true;
+    }
+
+private:
+    std::vector<uint8_t> & _data;
+    std::vector<uint8_t> _buff;
+};
+
+// More frames than the 8192 seek points FlacWriteJob keeps
+void testWriteJob(size_t frames,std::mt19937 & rng)
+{
+    static const uint32_t blockSize = 16;
+    static const int bits = 8;
+
+    const size_t total = frames * blockSize - 5;
+    std::uniform_real_distribution<float> level(-1.2f,1.2f);
+    std::vector<int32_t> expected;
+    std::vector<uint8_t> file;
+
+    JobQueue in(0);
+    JobQueue blocks;
+    JobQueue encoded;
+
+    // Chunk sizes unrelated to the block size
+    for(size_t i=0;i<total;)
+    {
+        JobQueue::dataptr_t data(new JobQueue::Data(std::min<size_t>(777,total - i)));
+
+        for(float & v : data->_vector)
+        {
+            v = std::sin(0.01f * float(i)) * 0.7f + 0.1f * level(rng);
+            i++;
+            // Clipped truncation as FlacEncodeJob does it
+            expected.push_back(int32_t(std::min(127.0f,std::max(-128.0f,v * 127.0f))));
+        }
+        in.push(data);
+    }
+    in.finish();
+
+    {
+        auto running = std::make_shared<std::atomic<int>>(0);
+        std::vector<JobExecutor::jobptr_t> jobs;
+
+        jobs.push_back(JobExecutor::jobptr_t(new BlockJob(in,blocks,blockSize)));
+        for(int e=0;e<3;e++)
+        {
+            jobs.push_back(JobExecutor::jobptr_t(new FlacEncodeJob(blocks,encoded,running,bits,blockSize)));
+        }
+        jobs.push_back(JobExecutor::jobptr_t(new FlacWriteJob(std::unique_ptr<ByteSink>(new MemorySink(file)),
+                                                               encoded,44100,bits,blockSize,uint64_t(-1) / 2)));
+
+        JobExecutor ex;
+        ex.addJobs(std::move(jobs));
+        ex.run();
+    }
+
+    Decoded d = decode(file);
+
+    check(d.total==total && d.samples==expected,"FlacWriteJob round trip");
+    check(d.frames.size()==frames,"FlacWriteJob frame count");
+    check(d.seekSize==8192,"FlacWriteJob seek table size");
+    check(d.seek.size()==std::min<size_t>(frames,8192),"FlacWriteJob seek points in use");
+    check(d.seek.front().sample==0,"first seek point not at the start");
+    checkSeekTable(d,file,blockSize);
+
+    // Evenly thinned, no gap much larger than the average
+    const uint64_t maxGap = (frames + 8191) / 8192 * blockSize;
+    for(size_t i=1;i<d.seek.size();i++)
+    {
+        check(d.seek[i].sample - d.seek[i-1].sample <= maxGap,"seek table thinned unevenly");
+    }
+    check(total - d.seek.back().sample <= maxGap,"seek table misses the end");
+
+    std::cout << "FlacWriteJob " << frames << " frames, " << d.seek.size() << " seek points" << std::endl;
+}
+
+// Known short lengths reserve a seek table to match, not the default
+void testShortStream(size_t total)
+{
+    static const uint32_t blockSize = 4096;
+    static const int bits = 8;
+
+    std::vector<uint8_t> file;
+
+    JobQueue in(0);
+    JobQueue blocks;
+    JobQueue encoded;
+
+    if(total > 0)
+    {
+        in.push(JobQueue::dataptr_t(new JobQueue::Data(total)));
+    }
+    in.finish();
+
+    {
+        auto running = std::make_shared<std::atomic<int>>(0);
+        std::vector<JobExecutor::jobptr_t> jobs;
+
+        jobs.push_back(JobExecutor::jobptr_t(new BlockJob(in,blocks,blockSize)));
+        jobs.push_back(JobExecutor::jobptr_t(new FlacEncodeJob(blocks,encoded,running,bits,blockSize)));
+        jobs.push_back(JobExecutor::jobptr_t(new FlacWriteJob(std::unique_ptr<ByteSink>(new MemorySink(file)),
+                                                               encoded,44100,bits,blockSize,total)));
+
+        JobExecutor ex;
+        ex.addJobs(std::move(jobs));
+        ex.run();
+    }
+
+    Decoded d = decode(file);
+
+    check(d.total==total && d.samples.size()==total,"short FlacWriteJob round trip");
+    check(d.seekSize==1,"short FlacWriteJob seek table size");
+    check(file.size() < 100,"short FlacWriteJob file too large");
+
+    std::cout << "FlacWriteJob " << total << " samples, " << file.size() << " bytes" << std::endl;
+}
+
+// Values STREAMINFO can't hold are refused, not truncated
+void testLimits()
+{
+    for(uint32_t rate : {0u,1048576u,2000000u})
+    {
+        FlacEncoder::StreamInfo info;
+        info.sampleRate = rate;
+        std::vector<uint8_t> header;
+        bool thrown = false;
+
+        try
+        {
+            FlacEncoder::writeHeader(info,{},0,header);
+        }
+        catch(const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        check(thrown,"sample rate " + std::to_string(rate) + " accepted");
+    }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    if(argc!=1)
+    {
+        std::cerr << "Usage: " << argv[0] << std::endl;
+        ::exit(1);
+    }
+
+    std::mt19937 rng(32);
+    std::map<std::string,size_t> seen;
+
+    testRoundTrip(seen,rng);
+
+    for(const char * t : {"constant","verbatim","fixed","lpc","rice","rice2"})
+    {
+        check(seen[t] > 0,std::string("no ") + t + " subframes/residuals covered");
+    }
+
+    testLimits();
+    testShortStream(0);
+    testShortStream(1);
+    testWriteJob(1000,rng);
+    testWriteJob(9000,rng);
+    testWriteJob(20000,rng);
+
+    std::cout << "Subframes:";
+    for(auto & t : seen)
+    {
+        std::cout << " " << t.first << " " << t.second;
+    }
+    std::cout << std::endl << "OK" << std::endl;
+}
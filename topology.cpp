@@ -0,0 +1,268 @@
+#include "topology.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+namespace {
+    // "0-3,8,10-11" -> {0,1,2,3,8,10,11}
+    std::vector<int> parseList(const std::string & s)
+    {
+        std::vector<int> l;
+        std::stringstream ss(s);
+        std::string range;
+
+        while(std::getline(ss,range,','))
+        {
+            int a = 0;
+            int b = 0;
+            char dash = 0;
+            std::stringstream rs(range);
+
+            if(!(rs >> a))
+            {
+                continue;
+            }
+
+            b = (rs >> dash >> b) && dash=='-' ? b : a;
+
+            for(int i=a;i<=b;i++)
+            {
+                l.push_back(i);
+            }
+        }
+
+        return l;
+    }
+
+    bool readLine(const std::string & fname,std::string & line)
+    {
+        std::ifstream f(fname);
+        return bool(std::getline(f,line));
+    }
+
+    int readInt(const std::string & fname,int def)
+    {
+        std::string line;
+        int v = def;
+
+        if(readLine(fname,line))
+        {
+            std::stringstream(line) >> v;
+        }
+
+        return v;
+    }
+}
+
+const CpuTopology & CpuTopology::get()
+{
+    static const CpuTopology topology;
+    return topology;
+}
+
+CpuTopology::CpuTopology()
+{
+    std::string line;
+    const std::string sys = "/sys/devices/system/cpu/";
+
+    if(readLine(sys + "online",line))
+    {
+        for(int id : parseList(line))
+        {
+            std::stringstream dir;
+            dir << sys << "cpu" << id << "/";
+
+            Cpu cpu;
+            cpu.id      = id;
+            cpu.package = readInt(dir.str() + "topology/physical_package_id",0);
+            cpu.core    = readInt(dir.str() + "topology/core_id",id);
+            cpu.llc     = id;
+
+#ifdef __linux__
+            // The node shows up as a nodeN link in the CPU directory
+            if(DIR * d = ::opendir(dir.str().c_str()))
+            {
+                while(dirent * e = ::readdir(d))
+                {
+                    std::string name = e->d_name;
+
+                    if(name.size() > 4 && name.compare(0,4,"node")==0)
+                    {
+                        std::stringstream(name.substr(4)) >> cpu.node;
+                    }
+                }
+                ::closedir(d);
+            }
+#endif
+
+            // Highest cache level wins, its lowest CPU names the cache
+            int level = 0;
+
+            for(int i=0;;i++)
+            {
+                std::stringstream idx;
+                idx << dir.str() << "cache/index" << i << "/";
+
+                int l = readInt(idx.str() + "level",-1);
+
+                if(l < 0)
+                {
+                    break;
+                }
+
+                if(l >= level && readLine(idx.str() + "shared_cpu_list",line))
+                {
+                    std::vector<int> shared = parseList(line);
+
+                    if(!shared.empty())
+                    {
+                        level   = l;
+                        cpu.llc = *std::min_element(shared.begin(),shared.end());
+                    }
+                }
+            }
+
+            _cpus.push_back(cpu);
+        }
+    }
+
+#ifdef __linux__
+    // Only the CPUs the process may run on (taskset, cgroup cpusets)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+
+    if(::sched_getaffinity(0,sizeof(allowed),&allowed) == 0)
+    {
+        std::vector<Cpu> usable;
+
+        for(auto & c : _cpus)
+        {
+            if(c.id < CPU_SETSIZE && CPU_ISSET(c.id,&allowed))
+            {
+                usable.push_back(c);
+            }
+        }
+
+        if(!usable.empty())
+        {
+            _cpus.swap(usable);
+        }
+    }
+#endif
+
+    if(_cpus.empty())
+    {
+        unsigned n = std::max(1u,std::thread::hardware_concurrency());
+
+        for(unsigned i=0;i<n;i++)
+        {
+            Cpu cpu;
+            cpu.id   = int(i);
+            cpu.core = int(i);
+            _cpus.push_back(cpu);
+        }
+    }
+
+    for(auto & c : _cpus)
+    {
+        _nodes = std::max(_nodes,c.node + 1);
+    }
+}
+
+int CpuTopology::node(int cpu) const
+{
+    for(auto & c : _cpus)
+    {
+        if(c.id == cpu)
+        {
+            return c.node;
+        }
+    }
+
+    return -1;
+}
+
+bool CpuTopology::has(int cpu) const
+{
+    return node(cpu) >= 0;
+}
+
+std::vector<int> CpuTopology::compact() const
+{
+    std::vector<Cpu> cpus = _cpus;
+
+    std::sort(cpus.begin(),cpus.end(),[](const Cpu & a,const Cpu & b) {
+        return std::make_tuple(a.node,a.package,a.llc,a.core,a.id)
+             < std::make_tuple(b.node,b.package,b.llc,b.core,b.id);
+    });
+
+    std::vector<int> order;
+
+    for(auto & c : cpus)
+    {
+        order.push_back(c.id);
+    }
+
+    return order;
+}
+
+std::vector<int> CpuTopology::spread() const
+{
+    // domain (node,package,llc) -> core (package,core) -> CPU ids
+    typedef std::tuple<int,int,int> domain_t;
+    typedef std::pair<int,int> core_t;
+
+    std::map<domain_t,std::map<core_t,std::vector<int>>> domains;
+
+    for(auto & c : _cpus)
+    {
+        domains[domain_t(c.node,c.package,c.llc)][core_t(c.package,c.core)].push_back(c.id);
+    }
+
+    std::vector<std::vector<std::vector<int>>> cores;
+    size_t maxCores = 0;
+    size_t maxThreads = 0;
+
+    for(auto & d : domains)
+    {
+        cores.emplace_back();
+
+        for(auto & c : d.second)
+        {
+            std::vector<int> threads = c.second;
+            std::sort(threads.begin(),threads.end());
+
+            maxThreads = std::max(maxThreads,threads.size());
+            cores.back().push_back(threads);
+        }
+
+        maxCores = std::max(maxCores,cores.back().size());
+    }
+
+    std::vector<int> order;
+
+    for(size_t t=0;t<maxThreads;t++)
+    {
+        for(size_t k=0;k<maxCores;k++)
+        {
+            for(auto & d : cores)
+            {
+                if(k < d.size() && t < d[k].size())
+                {
+                    order.push_back(d[k][t]);
+                }
+            }
+        }
+    }
+
+    return order;
+}
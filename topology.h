@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// CPU layout of the machine as far as thread placement cares:
+// which CPUs are hyperthread siblings, share a last level cache,
+// sit in the same package or on the same NUMA node.
+// Read from /sys on Linux, limited to the CPUs in the process
+// affinity mask, a flat single node elsewhere.
+
+class CpuTopology {
+public:
+    struct Cpu {
+        int id;
+        int package = 0;
+        int core = 0;
+        int node = 0;
+        int llc = 0; // lowest CPU id sharing the last level cache
+    };
+
+    static const CpuTopology & get();
+
+    const std::vector<Cpu> & cpus() const
+    {
+        return _cpus;
+    }
+
+    int nodes() const
+    {
+        return _nodes;
+    }
+
+    // Node of cpu or -1 if the CPU is unknown
+    int node(int cpu) const;
+
+    bool has(int cpu) const;
+
+    // Neighbours first: siblings, then the same cache, package, node
+    std::vector<int> compact() const;
+
+    // One CPU per core, round robin over nodes/packages/caches,
+    // hyperthread siblings only once every core has a thread
+    std::vector<int> spread() const;
+
+private:
+    CpuTopology();
+
+    std::vector<Cpu> _cpus;
+    int _nodes = 1;
+};
@@ -0,0 +1,657 @@
+#include "uring.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    std::runtime_error sysError(const std::string & what,int err=errno)
+    {
+        return std::runtime_error(what + ": " + std::strerror(err));
+    }
+
+    UringUnavailable unavailable(const std::string & what,int err=errno)
+    {
+        return UringUnavailable(what + ": " + std::strerror(err));
+    }
+}
+
+IoUring::IoUring(unsigned entries)
+    : _entries(entries)
+{
+    io_uring_params p;
+    std::memset(&p,0,sizeof(p));
+
+    _fd = int(::syscall(__NR_io_uring_setup,entries,&p));
+
+    if(_fd < 0)
+    {
+        throw unavailable("io_uring_setup");
+    }
+
+    _sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        _sqRingSize = _cqRingSize = std::max(_sqRingSize,_cqRingSize);
+    }
+
+    _sqRing = ::mmap(nullptr,_sqRingSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,_fd,IORING_OFF_SQ_RING);
+
+    if(_sqRing == MAP_FAILED)
+    {
+        int err = errno;
+        ::close(_fd);
+        throw unavailable("io_uring sq ring mmap",err);
+    }
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        _cqRing = _sqRing;
+    }
+    else
+    {
+        _cqRing = ::mmap(nullptr,_cqRingSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,_fd,IORING_OFF_CQ_RING);
+
+        if(_cqRing == MAP_FAILED)
+        {
+            int err = errno;
+            ::munmap(_sqRing,_sqRingSize);
+            ::close(_fd);
+            throw unavailable("io_uring cq ring mmap",err);
+        }
+    }
+
+    _sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    _sqes = (io_uring_sqe *)::mmap(nullptr,_sqesSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,_fd,IORING_OFF_SQES);
+
+    if(_sqes == MAP_FAILED)
+    {
+        int err = errno;
+        if(_cqRing != _sqRing)
+        {
+            ::munmap(_cqRing,_cqRingSize);
+        }
+        ::munmap(_sqRing,_sqRingSize);
+        ::close(_fd);
+        throw unavailable("io_uring sqe mmap",err);
+    }
+
+    uint8_t * sq = (uint8_t *)_sqRing;
+    uint8_t * cq = (uint8_t *)_cqRing;
+
+    _sqHead  = (unsigned *)(sq + p.sq_off.head);
+    _sqTail  = (unsigned *)(sq + p.sq_off.tail);
+    _sqMask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    _sqArray = (unsigned *)(sq + p.sq_off.array);
+    _cqHead  = (unsigned *)(cq + p.cq_off.head);
+    _cqTail  = (unsigned *)(cq + p.cq_off.tail);
+    _cqMask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    _cqes    = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    _entries = p.sq_entries;
+}
+
+IoUring::~IoUring()
+{
+    ::munmap(_sqes,_sqesSize);
+    if(_cqRing != _sqRing)
+    {
+        ::munmap(_cqRing,_cqRingSize);
+    }
+    ::munmap(_sqRing,_sqRingSize);
+    ::close(_fd);
+}
+
+void IoUring::registerBuffers(const std::vector<iovec> & iovs)
+{
+    if(::syscall(__NR_io_uring_register,_fd,IORING_REGISTER_BUFFERS,iovs.data(),unsigned(iovs.size())) < 0)
+    {
+        throw unavailable("io_uring_register buffers");
+    }
+}
+
+io_uring_sqe * IoUring::nextSqe()
+{
+    unsigned tail = *_sqTail;
+    unsigned head = __atomic_load_n(_sqHead,__ATOMIC_ACQUIRE);
+
+    if(tail - head >= _entries)
+    {
+        throw std::runtime_error("io_uring submission queue full");
+    }
+
+    unsigned idx = tail & *_sqMask;
+    io_uring_sqe * sqe = &_sqes[idx];
+
+    std::memset(sqe,0,sizeof(*sqe));
+    _sqArray[idx] = idx;
+
+    return sqe;
+}
+
+void IoUring::readFixed(int fd,void * buf,unsigned len,uint64_t offset,uint16_t index,uint64_t userData)
+{
+    io_uring_sqe * sqe = nextSqe();
+
+    sqe->opcode    = IORING_OP_READ_FIXED;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)buf;
+    sqe->len       = len;
+    sqe->off       = offset;
+    sqe->buf_index = index;
+    sqe->user_data = userData;
+
+    __atomic_store_n(_sqTail,*_sqTail + 1,__ATOMIC_RELEASE);
+    _queued++;
+}
+
+void IoUring::writeFixed(int fd,const void * buf,unsigned len,uint64_t offset,uint16_t index,uint64_t userData)
+{
+    io_uring_sqe * sqe = nextSqe();
+
+    sqe->opcode    = IORING_OP_WRITE_FIXED;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)buf;
+    sqe->len       = len;
+    sqe->off       = offset;
+    sqe->buf_index = index;
+    sqe->user_data = userData;
+
+    __atomic_store_n(_sqTail,*_sqTail + 1,__ATOMIC_RELEASE);
+    _queued++;
+}
+
+void IoUring::submit()
+{
+    while(_queued > 0)
+    {
+        int n = enter(_queued,0,0);
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EBUSY)
+            {
+                // Kernel is short on resources, wait() submits later
+                return;
+            }
+            throw sysError("io_uring_enter");
+        }
+
+        _queued -= std::min(unsigned(n),_queued);
+    }
+}
+
+bool IoUring::peek(uint64_t & userData,int32_t & res)
+{
+    unsigned head = *_cqHead;
+    unsigned tail = __atomic_load_n(_cqTail,__ATOMIC_ACQUIRE);
+
+    if(head == tail)
+    {
+        return false;
+    }
+
+    const io_uring_cqe & cqe = _cqes[head & *_cqMask];
+
+    userData = cqe.user_data;
+    res = cqe.res;
+
+    __atomic_store_n(_cqHead,head + 1,__ATOMIC_RELEASE);
+    return true;
+}
+
+void IoUring::wait(uint64_t & userData,int32_t & res)
+{
+    for(;;)
+    {
+        unsigned head = *_cqHead;
+        unsigned tail = __atomic_load_n(_cqTail,__ATOMIC_ACQUIRE);
+
+        if(head != tail && _queued == 0)
+        {
+            const io_uring_cqe & cqe = _cqes[head & *_cqMask];
+
+            userData = cqe.user_data;
+            res = cqe.res;
+
+            __atomic_store_n(_cqHead,head + 1,__ATOMIC_RELEASE);
+            return;
+        }
+
+        // Submit the queued entries, block only if nothing completed yet
+        unsigned submit = _queued;
+        int n = enter(submit,head == tail ? 1 : 0,head == tail ? IORING_ENTER_GETEVENTS : 0);
+
+        if(n < 0)
+        {
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            {
+                continue;
+            }
+            throw sysError("io_uring_enter");
+        }
+
+        _queued -= std::min(unsigned(n),_queued);
+    }
+}
+
+int IoUring::enter(unsigned submit,unsigned minComplete,unsigned flags)
+{
+    return int(::syscall(__NR_io_uring_enter,_fd,submit,minComplete,flags,nullptr,0));
+}
+
+UringBuffers::UringBuffers(IoUring & ring,size_t count,size_t size)
+    : _size(size)
+{
+    void * mem = nullptr;
+
+    if(::posix_memalign(&mem,4096,count * size) != 0)
+    {
+        throw UringUnavailable("Failed to allocate io_uring buffers");
+    }
+
+    _mem = (uint8_t *)mem;
+
+    std::vector<iovec> iovs(count);
+
+    for(size_t i=0;i<count;i++)
+    {
+        iovs[i].iov_base = data(i);
+        iovs[i].iov_len  = size;
+    }
+
+    try
+    {
+        ring.registerBuffers(iovs);
+    }
+    catch(...)
+    {
+        std::free(_mem);
+        throw;
+    }
+}
+
+UringBuffers::~UringBuffers()
+{
+    std::free(_mem);
+}
+
+UringSource::UringSource(const std::string & fname,unsigned depth,size_t blockSize)
+    : _depth(depth)
+    , _blockSize(blockSize)
+    , _ring(depth)
+{
+    _fd = ::open(fname.c_str(),O_RDONLY);
+
+    if(_fd < 0)
+    {
+        throw sysError("Failed to open '" + fname + "'");
+    }
+
+    struct stat st;
+
+    if(::fstat(_fd,&st) < 0)
+    {
+        int err = errno;
+        ::close(_fd);
+        throw sysError("Failed to stat '" + fname + "'",err);
+    }
+
+    _fileSize = uint64_t(st.st_size);
+}
+
+UringSource::~UringSource()
+{
+    // Reads still in flight may not land in freed buffers
+    while(!_inFlight.empty())
+    {
+        uint64_t slot;
+        int32_t res;
+
+        _ring.wait(slot,res);
+        _slots[slot].done = true;
+
+        while(!_inFlight.empty() && _slots[_inFlight.front()].done)
+        {
+            _inFlight.pop_front();
+        }
+    }
+
+    ::close(_fd);
+}
+
+bool UringSource::read(uint8_t * buf,size_t n)
+{
+    if(_buffers)
+    {
+        throw std::runtime_error("UringSource::read after streaming started");
+    }
+
+    while(n > 0)
+    {
+        ssize_t r = ::pread(_fd,buf,n,_offset);
+
+        if(r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if(r <= 0)
+        {
+            return false;
+        }
+
+        buf     += r;
+        n       -= r;
+        _offset += r;
+    }
+
+    return true;
+}
+
+void UringSource::submit(size_t slot)
+{
+    Slot & s = _slots[slot];
+
+    s.offset = _offset;
+    s.len    = size_t(std::min<uint64_t>(_buffers->size(),_fileSize - _offset));
+    s.done   = false;
+
+    _ring.readFixed(_fd,_buffers->data(slot),unsigned(s.len),s.offset,uint16_t(slot),slot);
+    _inFlight.push_back(slot);
+
+    _offset += s.len;
+}
+
+const uint8_t * UringSource::next(size_t max,size_t & n)
+{
+    n = 0;
+
+    if(_plain)
+    {
+        return nextPlain(max,n);
+    }
+
+    if(!_buffers)
+    {
+        // Blocks are whole multiples of max, so every piece but the
+        // very last one has the full requested size
+        size_t block = std::max<size_t>(1,_blockSize / max) * max;
+
+        try
+        {
+            _buffers.reset(new UringBuffers(_ring,_depth,block));
+        }
+        catch(const UringUnavailable & e)
+        {
+            // Typically RLIMIT_MEMLOCK, the file is open already
+            std::cerr << e.what() << ", reading with pread" << std::endl;
+            _plain = true;
+            return nextPlain(max,n);
+        }
+        _slots.resize(_depth);
+
+        for(size_t i=0;i<_depth && _offset < _fileSize;i++)
+        {
+            submit(i);
+        }
+        _ring.submit();
+    }
+
+    if(_haveCur)
+    {
+        Slot & s = _slots[_cur];
+
+        if(_curPos < s.len)
+        {
+            n = std::min(max,s.len - _curPos);
+            _curPos += n;
+            return _buffers->data(_cur) + _curPos - n;
+        }
+
+        // Block consumed, reuse its buffer further down the file
+        _haveCur = false;
+
+        if(_offset < _fileSize)
+        {
+            submit(_cur);
+            _ring.submit();
+        }
+    }
+
+    if(_inFlight.empty())
+    {
+        return nullptr;
+    }
+
+    size_t front = _inFlight.front();
+
+    while(!_slots[front].done)
+    {
+        uint64_t slot;
+        int32_t res;
+
+        _ring.wait(slot,res);
+        _slots[slot].res  = res;
+        _slots[slot].done = true;
+    }
+
+    _inFlight.pop_front();
+
+    Slot & s = _slots[front];
+
+    if(s.res < 0)
+    {
+        throw sysError("io_uring read",-s.res);
+    }
+
+    if(size_t(s.res) != s.len)
+    {
+        throw std::runtime_error("io_uring short read");
+    }
+
+    _cur     = front;
+    _curPos  = std::min(max,s.len);
+    _haveCur = true;
+    n        = _curPos;
+
+    return n==0 ? nullptr : _buffers->data(_cur);
+}
+
+const uint8_t * UringSource::nextPlain(size_t max,size_t & n)
+{
+    n = size_t(std::min<uint64_t>(max,_fileSize - _offset));
+
+    if(n==0)
+    {
+        return nullptr;
+    }
+
+    _plainBuff.resize(n);
+
+    if(!read(_plainBuff.data(),n))
+    {
+        throw sysError("pread");
+    }
+
+    return _plainBuff.data();
+}
+
+UringSink::UringSink(const std::string & fname,unsigned depth,size_t blockSize)
+    : _ring(depth)
+    , _buffers(_ring,depth,blockSize)
+    , _lens(depth)
+{
+    _fd = ::open(fname.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+
+    if(_fd < 0)
+    {
+        throw sysError("Failed to open '" + fname + "'");
+    }
+
+    for(size_t i=depth;i>0;i--)
+    {
+        _free.push_back(i-1);
+    }
+}
+
+UringSink::~UringSink()
+{
+    drain();
+    ::close(_fd);
+}
+
+size_t UringSink::maxChunk() const
+{
+    return _buffers.size();
+}
+
+uint8_t * UringSink::buffer(size_t n)
+{
+    if(n > _buffers.size())
+    {
+        throw std::runtime_error("UringSink::buffer larger than maxChunk()");
+    }
+
+    if(_haveCur && _fill + n > _buffers.size())
+    {
+        submitCurrent();
+    }
+
+    if(!_haveCur)
+    {
+        // Take back buffers whose writes are done already
+        uint64_t slot;
+        int32_t res;
+
+        while(_inFlight > 0 && _ring.peek(slot,res))
+        {
+            complete(slot,res);
+        }
+
+        while(_free.empty())
+        {
+            reap();
+        }
+
+        _cur = _free.back();
+        _free.pop_back();
+        _fill = 0;
+        _haveCur = true;
+    }
+
+    return _buffers.data(_cur) + _fill;
+}
+
+bool UringSink::commit(size_t n)
+{
+    _fill += n;
+
+    if(_fill == _buffers.size())
+    {
+        submitCurrent();
+    }
+
+    return !_failed;
+}
+
+bool UringSink::writeAt(uint64_t offset,const uint8_t * data,size_t n)
+{
+    drain();
+
+    while(n > 0)
+    {
+        ssize_t r = ::pwrite(_fd,data,n,offset);
+
+        if(r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if(r <= 0)
+        {
+            _failed = true;
+            return false;
+        }
+
+        data   += r;
+        n      -= r;
+        offset += r;
+    }
+
+    return !_failed;
+}
+
+bool UringSink::good() const
+{
+    return !_failed;
+}
+
+void UringSink::submitCurrent()
+{
+    if(!_haveCur)
+    {
+        return;
+    }
+
+    _haveCur = false;
+
+    if(_fill == 0)
+    {
+        _free.push_back(_cur);
+        return;
+    }
+
+    _lens[_cur] = _fill;
+    _ring.writeFixed(_fd,_buffers.data(_cur),unsigned(_fill),_offset,uint16_t(_cur),_cur);
+    _ring.submit();
+    _offset += _fill;
+    _inFlight++;
+}
+
+void UringSink::reap()
+{
+    uint64_t slot;
+    int32_t res;
+
+    _ring.wait(slot,res);
+    complete(slot,res);
+}
+
+void UringSink::complete(uint64_t slot,int32_t res)
+{
+    _inFlight--;
+
+    // Regular files don't write short unless the disk is full
+    if(res < 0 || size_t(res) != _lens[slot])
+    {
+        _failed = true;
+    }
+
+    _free.push_back(slot);
+}
+
+void UringSink::drain()
+{
+    submitCurrent();
+
+    while(_inFlight > 0)
+    {
+        reap();
+    }
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "byteio.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// The kernel refused a ring or registered buffers: no io_uring
+// (ENOSYS), not permitted (EPERM under seccomp or the sysctl) or
+// over RLIMIT_MEMLOCK (ENOMEM). Plain I/O still works.
+
+class UringUnavailable : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Minimal io_uring wrapper on the raw syscalls, no liburing.
+// Single threaded use only, every reader/writer owns one ring.
+
+class IoUring {
+public:
+    IoUring(unsigned entries);
+    ~IoUring();
+
+    IoUring(const IoUring &) = delete;
+    IoUring & operator=(const IoUring &) = delete;
+
+    void registerBuffers(const std::vector<iovec> & iovs);
+
+    // Queue a READ_FIXED/WRITE_FIXED on registered buffer index
+    void readFixed(int fd,void * buf,unsigned len,uint64_t offset,uint16_t index,uint64_t userData);
+    void writeFixed(int fd,const void * buf,unsigned len,uint64_t offset,uint16_t index,uint64_t userData);
+
+    // Hand what is queued to the kernel, don't wait
+    void submit();
+
+    // A completion that already arrived, false if there is none
+    bool peek(uint64_t & userData,int32_t & res);
+
+    // Submit what is queued and wait for one completion
+    void wait(uint64_t & userData,int32_t & res);
+
+private:
+    io_uring_sqe * nextSqe();
+    int enter(unsigned submit,unsigned minComplete,unsigned flags);
+
+    int _fd = -1;
+    void * _sqRing = nullptr;
+    void * _cqRing = nullptr;
+    size_t _sqRingSize = 0;
+    size_t _cqRingSize = 0;
+    io_uring_sqe * _sqes = nullptr;
+    size_t _sqesSize = 0;
+
+    unsigned * _sqHead;
+    unsigned * _sqTail;
+    unsigned * _sqMask;
+    unsigned * _sqArray;
+    unsigned * _cqHead;
+    unsigned * _cqTail;
+    unsigned * _cqMask;
+    io_uring_cqe * _cqes;
+
+    unsigned _entries;
+    unsigned _queued = 0;
+};
+
+// Fixed set of page aligned buffers registered with a ring
+
+class UringBuffers {
+public:
+    UringBuffers(IoUring & ring,size_t count,size_t size);
+    ~UringBuffers();
+
+    uint8_t * data(size_t i)
+    {
+        return _mem + i * _size;
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+
+private:
+    uint8_t * _mem = nullptr;
+    size_t _size;
+};
+
+// Reads ahead up to depth blocks of a file and hands them out in
+// order. Falls back to pread when the buffers can't be registered.
+
+class UringSource : public ByteSource {
+public:
+    UringSource(const std::string & fname,unsigned depth=8,size_t blockSize=1<<16);
+    ~UringSource() override;
+
+    bool read(uint8_t * buf,size_t n) override;
+    const uint8_t * next(size_t max,size_t & n) override;
+
+private:
+    struct Slot {
+        uint64_t offset = 0;
+        size_t len = 0;
+        int32_t res = 0;
+        bool done = false;
+    };
+
+    void submit(size_t slot);
+    const uint8_t * nextPlain(size_t max,size_t & n);
+
+    int _fd;
+    uint64_t _fileSize;
+    uint64_t _offset = 0;
+    unsigned _depth;
+    size_t _blockSize;
+    IoUring _ring;
+    std::unique_ptr<UringBuffers> _buffers;
+    std::vector<Slot> _slots;
+    std::deque<size_t> _inFlight; // in file order
+    size_t _cur = 0;
+    size_t _curPos = 0;
+    bool _haveCur = false;
+    bool _plain = false;
+    std::vector<uint8_t> _plainBuff;
+};
+
+// Collects appended bytes in registered blocks and keeps up to
+// depth block writes in flight
+
+class UringSink : public ByteSink {
+public:
+    UringSink(const std::string & fname,unsigned depth=8,size_t blockSize=1<<16);
+    ~UringSink() override;
+
+    size_t maxChunk() const override;
+    uint8_t * buffer(size_t n) override;
+    bool commit(size_t n) override;
+    bool writeAt(uint64_t offset,const uint8_t * data,size_t n) override;
+    bool good() const override;
+
+private:
+    void submitCurrent();
+    void reap();
+    void complete(uint64_t slot,int32_t res);
+    void drain();
+
+    int _fd;
+    uint64_t _offset = 0;
+    IoUring _ring;
+    UringBuffers _buffers;
+    std::vector<size_t> _free;
+    std::vector<size_t> _lens;
+    size_t _inFlight = 0;
+    size_t _cur = 0;
+    size_t _fill = 0;
+    bool _haveCur = false;
+    bool _failed = false;
+};
@@ -1,473 +1,376 @@
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 
-#include "jobpool.h"
+#include <thread>
 
-class SplitJob : public Job {
+#include "wavjobs.h"
+#ifdef HAVE_IO_URING
+#include "uring.h"
+#endif
 
-public:
-    typedef JobQueue queue_t;
-    SplitJob(queue_t & from,queue_t & left,queue_t & right)
-        : _from(from)
-        , _left(left)
-        , _right(right)
-    {
-    }
+// Below this much PCM data the pipeline runs on one thread in auto
+// mode. See the executor benchmark of wavefilter_bench for the
+// crossover on a given machine.
+static const size_t singleThreadBytes = 4 << 20;
 
-    bool run () override
+int main(int argc, char **argv)
+{
+    uint32_t outRate = 0;
+    bool analyze = false;
+    std::string io = "stream";
+    unsigned depth = 8;
+    JobPool::Placement placement = JobPool::Placement::None;
+    std::vector<int> cpus;
+    std::string mode = "auto";
+    std::string format = "wav";
+    unsigned encoders = std::max(1u,std::thread::hardware_concurrency() / 2);
+    bool threadOptions = false; // -p or -j given
+    std::string fname;
+
+    for(int i=1;i<argc;i++)
     {
-        queue_t::dataptr_t data;
+        std::string arg = argv[i];
 
-        if(!_from.pop(data))
+        if(arg=="-r" && i+1<argc)
         {
-            _left.finish();
-            _right.finish();
-            return false;
-        }
+            std::stringstream ss(argv[++i]);
 
-        queue_t::dataptr_t ldata;
-        queue_t::dataptr_t rdata;
-
-        bool odd = (data->_vector.size() & 1) != 0;
-
-        int ool = odd ? _oddToggle ? 1 : 0 : 0;
-        int oor = odd ? _oddToggle ? 0 : 1 : 0;
-
-
-        ldata.reset( new queue_t::Data(data->_vector.size() / 2 + oor ) );
-        rdata.reset( new queue_t::Data(data->_vector.size() / 2 + ool ) );
-#if 0
-        std::cerr << ool << "::" << oor << " @ "
-                  << ldata->_vector.size() << "::"
-                  << rdata->_vector.size() << "::"
-                  << std::endl;
-#endif
-        for(size_t i=0; i<data->_vector.size() / 2;i++)
+            if( !(ss >> outRate) || !(ss >> std::ws).eof() || outRate==0 )
+            {
+                std::cerr << argv[i] << " does't seem to be a positive sample rate" << std::endl;
+                exit(1);
+            }
+        }
+        else if(arg=="-a")
         {
-            ldata->_vector[ i ] = data->_vector[ i * 2 + ool ];
-            rdata->_vector[ i ] = data->_vector[ i * 2 + oor ];
+            analyze = true;
         }
-
-        if(odd)
+        else if(arg=="-i" && i+1<argc)
         {
-            if(_oddToggle)
+            io = argv[++i];
+
+            if(io!="stream" && io!="uring")
             {
-                rdata->_vector[data->_vector.size() / 2 ] = data->_vector.back();
+                std::cerr << io << " is neither 'stream' nor 'uring'" << std::endl;
+                exit(1);
             }
-            else
+#ifndef HAVE_IO_URING
+            if(io=="uring")
             {
-                ldata->_vector[data->_vector.size() / 2 ] = data->_vector.back();
+                std::cerr << "io_uring support not compiled in" << std::endl;
+                exit(1);
             }
+#endif
         }
-
-        _oddToggle = odd ? _oddToggle ? false : true : true ;
-
-        _left.push(ldata);
-        _right.push(rdata);
-
-        return true;
-    }
-
-private:
-    queue_t & _from;
-    queue_t & _left;
-    queue_t & _right;
-    size_t _oddToggle = false; // last data was odd sized
-};
-
-
-class WavPcmReadJob : public Job
-{
-public:
-    typedef JobQueue queue_t;
-
-    WavPcmReadJob(std::istream & is,queue_t & to)
-        : _is(is)
-        , _to(to)
-    {
-        const std::string riffTag="RIFF";
-        static const int tagSize = 4;
-
-        uint8_t buff[tagSize];
-
-        if(!is.read((char *)buff,tagSize) || std::string((char*)buff,tagSize)!=riffTag)
-        {
-            throw std::runtime_error("Failed to detect '" + riffTag +"'");
-        }
-
-        if(!is.read((char*)buff,tagSize))
+        else if(arg=="-q" && i+1<argc)
         {
-            throw std::runtime_error("Failed to detect '" + riffTag + "' size");
-        }
-
-        size_t size = getLong(buff);
+            std::stringstream ss(argv[++i]);
 
-        const std::string wavTag ="WAVE";
-
-        if(!is.read((char*)buff,tagSize) || std::string((char*)buff,tagSize)!=wavTag)
-        {
-            throw std::runtime_error("Failed to detect '" + wavTag + "'");
+            if( !(ss >> depth) || !(ss >> std::ws).eof() || depth==0 || depth>256 )
+            {
+                std::cerr << argv[i] << " does't seem to be a queue depth 1..256" << std::endl;
+                exit(1);
+            }
         }
-
-        const std::string fmtTag ="fmt ";
-
-        if(!is.read((char *)buff,tagSize) || std::string((char*)buff,tagSize)!=fmtTag)
+        else if(arg=="-m" && i+1<argc)
         {
-            throw std::runtime_error("Failed to detect '" + fmtTag + "'");
-        }
+            mode = argv[++i];
 
-        if(!is.read((char*)buff,tagSize))
-        {
-            throw std::runtime_error("Failed to detect '" + fmtTag + "' size");
+            if(mode!="auto" && mode!="threads" && mode!="single")
+            {
+                std::cerr << mode << " is neither 'auto', 'threads' nor 'single'" << std::endl;
+                exit(1);
+            }
         }
-        size = getLong(buff);
-        static const int fmtSize = 16;
-        if(size!=fmtSize)
+        else if(arg=="-o" && i+1<argc)
         {
-            std::stringstream ss;
-            ss << "expected fmt chunk of size " << fmtSize;
-            throw std::runtime_error(ss.str());
-        }
-
-        uint8_t fmtBuff[fmtSize];
+            format = argv[++i];
 
-        if(!is.read((char*)fmtBuff,fmtSize))
-        {
-            throw std::runtime_error("Failed to read '" + fmtTag + "' buffer");
-        }
-
-        const std::string dataTag ="data";
-
-        if(!is.read((char *)buff,tagSize) || std::string((char*)buff,tagSize)!=dataTag)
-        {
-            throw std::runtime_error("Failed to detect '" + dataTag + "'");
+            if(format!="wav" && format!="flac")
+            {
+                std::cerr << format << " is neither 'wav' nor 'flac'" << std::endl;
+                exit(1);
+            }
         }
-
-        if(!is.read((char *)buff,tagSize) )
+        else if(arg=="-j" && i+1<argc)
         {
-            throw std::runtime_error("Failed to read '" + dataTag + "' size");
-        }
-
-        _dataSize = getLong(buff);
-
-        const uint8_t * fmtPtr = fmtBuff;
+            std::stringstream ss(argv[++i]);
 
-        if(getWord(fmtPtr,fmtPtr)!=1)
-        {
-            throw std::runtime_error("Only handle PCM data");
+            if( !(ss >> encoders) || !(ss >> std::ws).eof() || encoders==0 || encoders>64 )
+            {
+                std::cerr << argv[i] << " does't seem to be an encoder count 1..64" << std::endl;
+                exit(1);
+            }
+            threadOptions = true;
         }
-
-        _channels = getWord(fmtPtr,fmtPtr);
-        if(_channels!=1 && _channels!=2)
+        else if(arg=="-p" && i+1<argc)
         {
-            throw std::runtime_error("Only handle Mono/Stereo");
-        }
+            std::string p = argv[++i];
 
-        _sampleRate = getLong(fmtPtr,fmtPtr);
-        _dataRate = getLong(fmtPtr,fmtPtr);
-        _frameSize = getWord(fmtPtr,fmtPtr);
-        _bitSize  = getWord(fmtPtr,fmtPtr);
+            threadOptions = true;
 
-        if(_bitSize != 8 && _bitSize != 16 &&  _bitSize != 24 &&  _bitSize != 32)
-        {
-            throw std::runtime_error("Sorr only 8/16/24/32 bts/sample for now");
-        }
+            if(p=="none")
+            {
+                placement = JobPool::Placement::None;
+            }
+            else if(p=="compact")
+            {
+                placement = JobPool::Placement::Compact;
+            }
+            else if(p=="spread")
+            {
+                placement = JobPool::Placement::Spread;
+            }
+            else
+            {
+                // Explicit list "0,2,4"
+                std::stringstream ss(p);
+                int cpu;
+                char sep = ',';
 
-        std::cerr << "Channels:" << _channels << " "
-                  << "SampleRate:" << _sampleRate << " "
-                  << "DataRate:" << _dataRate << " "
-                  << "FrameSize:" << _frameSize << " "
-                  << "BitSize:" << _bitSize << " "
-                  << "Datasize:" << _dataSize << std::endl;
+                placement = JobPool::Placement::List;
 
+                while(sep==',' && ss >> cpu)
+                {
+                    cpus.push_back(cpu);
+                    sep = 0;
+                    ss >> sep;
+                }
 
-        if(_frameSize != _channels * _bitSize / 8)
+                if(cpus.empty() || !ss.eof() || sep!=0)
+                {
+                    std::cerr << p << " is neither 'none', 'compact', 'spread' nor a CPU list" << std::endl;
+                    exit(1);
+                }
+            }
+        }
+        else if(fname.empty() && !arg.empty() && arg[0]!='-')
         {
-            std::stringstream ss;
-            ss<< "Expected FrameSize to be " << _channels * _bitSize / 8;
-            throw std::runtime_error(ss.str());
+            fname = arg;
         }
-
-        if(_dataRate != _frameSize * _sampleRate)
+        else
         {
-            std::stringstream ss;
-            ss<< "Expected DataRate to be " <<_frameSize * _sampleRate;
-            throw std::runtime_error(ss.str());
+            fname.clear();
+            break;
         }
     }
-    virtual
-    ~WavPcmReadJob()
-    {
-        std::cerr << "Samples read:" << _samplesRead << std::endl;
-    }
 
-public:
-    bool run() override
+    if(fname.empty())
     {
-        static const size_t chunkSize = 1000;
-        std::vector<uint8_t> buff(_frameSize*chunkSize);
-
-        if(!_is)
-        {
-			_to.finish();
-            return false;
-        }
-
-        _is.read((char *)buff.data(),buff.size());
+        std::cerr << "Usage: wavefilter [-r samplerate] [-a] [-i stream|uring] [-q depth] [-p placement] [-m mode] [-o format] [-j encoders] audio.wav" << std::endl
+                  << "  -r  resample outputs to samplerate" << std::endl
+                  << "  -a  write level statistics of each output next to it (.json)" << std::endl
+                  << "      and the job placement to placement.json when threaded" << std::endl
+                  << "  -i  I/O backend, blocking streams (default) or io_uring, streams if the kernel refuses it" << std::endl
+                  << "  -q  io_uring reads/writes in flight per file (default 8)" << std::endl
+                  << "  -p  thread placement: none (default), compact, spread or CPU list 0,2,4" << std::endl
+                  << "  -m  threads, single (one thread, coroutines) or auto (default, by input size," << std::endl
+                  << "      threads if -p or -j is given)" << std::endl
+                  << "  -o  output format, 8 bit wav (default) or lossless flac of the same samples" << std::endl
+                  << "  -j  flac encoder jobs per output (default half the CPUs)" << std::endl;
+        exit(1);
+    }
 
-        if(_is.gcount()==0)
+    auto source = [&](const std::string & f) {
+#ifdef HAVE_IO_URING
+        if(io=="uring")
         {
-            _to.finish();
-            return false;
+            try
+            {
+                return std::unique_ptr<ByteSource>(new UringSource(f,depth));
+            }
+            catch(const UringUnavailable & e)
+            {
+                std::cerr << e.what() << ", using streams for '" << f << "'" << std::endl;
+            }
         }
-		
+#endif
+        return std::unique_ptr<ByteSource>(new StreamSource(f));
+    };
 
-        if(_is.gcount() % (_frameSize) != 0 )
+    auto sink = [&](const std::string & f) {
+#ifdef HAVE_IO_URING
+        if(io=="uring")
         {
-            std::stringstream ss;
-            ss << " expected read bytes to be multiples of " << _frameSize << " found " << _is.gcount();
-            throw std::runtime_error(ss.str());
+            try
+            {
+                return std::unique_ptr<ByteSink>(new UringSink(f,depth));
+            }
+            catch(const UringUnavailable & e)
+            {
+                std::cerr << e.what() << ", using streams for '" << f << "'" << std::endl;
+            }
         }
+#endif
+        return std::unique_ptr<ByteSink>(new StreamSink(f));
+    };
 
-        buff.resize(_is.gcount());
+    // Data queue frok file to split-job
+    JobQueue read_q;
 
-        queue_t::dataptr_t data(new queue_t::Data( buff.size() / _frameSize * _channels ));
+    // left output queue for split-job
+    JobQueue left_q;
 
-        size_t iidx = 0;
-        size_t oidx = 0;
+    // right output queue for split-job
+    JobQueue right_q;
 
-        uint8_t *ptr = buff.data();
+    // Queues of the optional stages between split and write
+    std::vector<std::unique_ptr<JobQueue>> stage_q;
 
-        for(int i=0;i<_is.gcount() / _frameSize ;i++)
-        {
-            for(int j=0;j<_channels;j++)
-            {
-                long lo=0;
-                unsigned long mx=0;
+    // One meter per output, written after the pool is done
+    std::vector<std::unique_ptr<Meter>> meters;
 
-                for(int k=1;k<=_bitSize/8;k++)
-                {
-                    lo <<= 8;
-                    mx <<= 8;
-                    lo  |= ptr[ _bitSize / 8 - k ];
-                    mx  |= 0xff;
-                }
+    JobPool jp;
 
-                ptr += _bitSize/8;
-                data->_vector[oidx] = 1.0f - float(lo) / float( mx / 2 );
-                oidx++;
-            }
-        }
+    jp.setPlacement(placement,cpus);
 
-        _samplesRead += data->_vector.size();
+    std::shared_ptr<WavPcmReadJob> reader(new WavPcmReadJob(source(fname),read_q));
 
-        _to.push(data);
-        return true;
-    }
+    uint32_t inRate = reader->sampleRate();
 
-private:
-    uint16_t getWord(const uint8_t * buff,const uint8_t * & next=_dummyRef)
+    if(outRate==0)
     {
-        uint16_t w = uint16_t(buff[1]) << 8 | uint16_t(buff[0]);
-        next = buff+2;
-        return w;
+        outRate = inRate;
     }
 
-    uint32_t getLong(const uint8_t * buff,const uint8_t * & next=_dummyRef)
+    if(format=="flac" && outRate > FlacEncoder::maxSampleRate)
     {
-        uint32_t l = uint32_t(buff[3]) << 24 | uint32_t(buff[2]) << 16 | uint32_t(buff[1]) << 8 | uint32_t(buff[0]);
-        next = buff+4;
-        return l;
+        std::cerr << "FLAC can't store a sample rate of " << outRate << ", at most " << FlacEncoder::maxSampleRate << std::endl;
+        exit(1);
     }
 
-    int _channels;
-    uint32_t _sampleRate;
-    uint32_t _dataRate;
-    uint16_t _frameSize;
-    uint16_t _bitSize;
-    size_t _dataSize;
-    size_t _samplesRead=0;
-    static const uint8_t * _dummyRef;
-    std::istream & _is;
-    queue_t & _to;
-};
-
-const uint8_t * WavPcmReadJob::_dummyRef;
-
-
-class WavPcmWriteJob : public Job
-{
-    typedef Job super;
-public:
-    typedef JobQueue queue_t;
-
-    WavPcmWriteJob(std::ostream & os,queue_t & from)
-        : _os(os)
-        , _from(from)
+    if(outRate!=inRate)
     {
-        writeHeader();
+        std::cerr << "Resampling " << inRate << " -> " << outRate << std::endl;
     }
 
-    WavPcmWriteJob(const std::string & fname,queue_t & from)
-        : _os(_of)
-        , _from(from)
-    {
-        _of.open(fname);
-        writeHeader();
-    }
+    // Pool of jobs read->split->[resample]->[analyze]->write
+    std::vector<JobPool::jobptr_t> jobs;
 
-    virtual
-    ~WavPcmWriteJob() override
-    {
-        _from.finish();
-        if(_os)
-        {
-            _os.seekp(4,std::ios::beg);
-            std::vector<uint8_t> size(4);
-            putLong(size.data(),_dataSize+34);
-            _os.write((char*)size.data(),size.size());
-
-            _os.seekp(40,std::ios::beg);
-            putLong(size.data(),_dataSize);
-            _os.write((char*)size.data(),size.size());
-        }
-    }
+    jobs.push_back(reader);
+    jobs.push_back(JobPool::jobptr_t(new SplitJob(read_q,left_q,right_q)));
 
-    bool run() override
+    for(auto out : { std::make_pair(&left_q,std::string("left")),
+                     std::make_pair(&right_q,std::string("right")) })
     {
-        queue_t::dataptr_t data;
+        JobQueue * q = out.first;
 
-        if(!_from.pop(data))
+        if(outRate!=inRate)
         {
-            return false;
+            stage_q.emplace_back(new JobQueue());
+            jobs.push_back(JobPool::jobptr_t(new ResampleJob(*q,*stage_q.back(),inRate,outRate)));
+            q = stage_q.back().get();
         }
 
-        std::vector<int8_t> buff(data->_vector.size());
-        int8_t *ptr = buff.data();
-
-        for(size_t i=0;i<data->_vector.size();i++)
+        if(analyze)
         {
-            // std::cerr << data->_vector[i]  << "::"
-            //          << (int)int8_t(data->_vector[i] * float(0x7f)) << std::endl;
-
-            int8_t v = int8_t(data->_vector[i] * float(0x7f));
-            *(ptr++) = v;
+            stage_q.emplace_back(new JobQueue());
+            meters.emplace_back(new Meter(out.second + "." + format));
+            jobs.push_back(JobPool::jobptr_t(new AnalysisTapJob(*q,*stage_q.back(),*meters.back())));
+            q = stage_q.back().get();
         }
 
-        if( ! _os.write((char *)buff.data(),buff.size()) )
+        if(format=="flac")
         {
-            return false;
-        }
-
-        _dataSize+=buff.size();
-
-        return true;
-    }
-
-private:
+            // Blocks are encoded in parallel, the writer puts them back in order
+            static const uint32_t blockSize = 4096;
+            static const int bits = 8;
 
-    void writeHeader()
-    {
-        std::string tag="RIFF";
-        _os.write(tag.c_str(),tag.size());
-        std::vector<uint8_t> size(4);
+            // Rounded up, a short estimate would thin the seek table
+            uint64_t expected = (uint64_t(reader->samples() / 2) * outRate + inRate - 1) / inRate;
+            auto running = std::make_shared<std::atomic<int>>(0);
 
-        putLong(size.data(),0x01020304);
-        _os.write((char*)size.data(),size.size());
+            stage_q.emplace_back(new JobQueue());
+            jobs.push_back(JobPool::jobptr_t(new BlockJob(*q,*stage_q.back(),blockSize)));
+            q = stage_q.back().get();
 
-        tag="WAVE";
-        _os.write(tag.c_str(),tag.size());
+            stage_q.emplace_back(new JobQueue());
 
-        tag="fmt ";
-        _os.write(tag.c_str(),tag.size());
+            for(unsigned e=0;e<encoders;e++)
+            {
+                jobs.push_back(JobPool::jobptr_t(new FlacEncodeJob(*q,*stage_q.back(),running,bits,blockSize)));
+            }
+            q = stage_q.back().get();
 
-        putLong(size.data(),16);
-        _os.write((char*)size.data(),size.size());
+            jobs.push_back(JobPool::jobptr_t(new FlacWriteJob(sink(out.second + ".flac"),*q,outRate,bits,blockSize,expected)));
+        }
+        else
+        {
+            jobs.push_back(JobPool::jobptr_t(new WavPcmWriteJob(sink(out.second + ".wav"),*q,outRate)));
+        }
+    }
 
-        std::vector<uint8_t> fmt(16);
-        uint8_t * fmpt = fmt.data();
+    // Small inputs don't pay off the threads and hand-offs, unless
+    // the threads were asked for
+    bool single = mode=="single" ||
+        (mode=="auto" && !threadOptions &&
+         (reader->dataSize() < singleThreadBytes || std::thread::hardware_concurrency() < 2));
 
-        putWord(fmpt,1,fmpt); //PCM
-        putWord(fmpt,1,fmpt); // CHANELS
-        putLong(fmpt,44100,fmpt);
-        putLong(fmpt,176400/2,fmpt);
-        putWord(fmpt,1,fmpt); // frame
-        putWord(fmpt,8,fmpt); // bits
+    if(single)
+    {
+        std::cerr << "Single threaded" << std::endl;
 
-        _os.write((char*)fmt.data(),fmt.size());
+        if(threadOptions)
+        {
+            std::cerr << "Ignoring -p/-j, they only apply with threads" << std::endl;
+        }
 
-        tag="data";
-        _os.write(tag.c_str(),tag.size());
+        JobExecutor ex;
 
-        putLong(size.data(),0xf1f2f3f4);
-        _os.write((char*)size.data(),size.size());
+        ex.addJobs(std::move(jobs));
+        ex.run();
     }
+    else
+    {
+        // Add jobs ti pool
+        jp.addJobs(std::move(jobs));
 
+        // start the bool
+        jp.start();
 
-    void putLong(uint8_t *data,unsigned long l, uint8_t * & next=_dummy)
-    {
-        for(int i=0;i<4;i++)
+        if(placement!=JobPool::Placement::None)
         {
-            data[i] = uint8_t(l & 0xff);
-            l >>= 8;
+            std::cerr << "Placement:";
+            jp.writePlacement(std::cerr);
+            std::cerr << std::endl;
         }
-        next = data+4;
+
+        jp.join();
     }
-    void putWord(uint8_t *data,unsigned int l,uint8_t * & next = _dummy)
+
+    // left.wav/left.flac -> left.json
+    for(auto & m : meters)
     {
-        for(int i=0;i<2;i++)
+        std::string jname = m->name().substr(0,m->name().rfind('.')) + ".json";
+        std::ofstream jf(jname);
+
+        m->writeJson(jf);
+
+        if(!jf)
         {
-            data[i] = uint8_t(l & 0xff);
-            l >>= 8;
+            std::cerr << "Failed to write '" << jname << "'" << std::endl;
+            return 1;
         }
-        next = data+2;
     }
-    size_t _dataSize=0;
-    std::ofstream _of;
-    std::ostream & _os;
-    queue_t & _from;
-    static uint8_t * _dummy;
-};
 
-uint8_t * WavPcmWriteJob::_dummy;
-
-int main(int argc, char **argv)
-{
-    if(argc!=2)
+    if(analyze && !single)
     {
-        std::cerr << "Usage: wavefilter audio.wav" << std::endl;
-        exit(1);
-    }
-
-	std::ifstream fi;
-    fi.open(argv[1],std::ios::binary);
+        std::ofstream pf("placement.json");
 
-    // Data queue frok file to split-job
-    JobQueue read_q;
-
-    // left output queue for split-job
-    JobQueue left_q;
+        jp.writePlacement(pf);
+        pf << std::endl;
 
-    // right output queue for split-job
-    JobQueue right_q;
-
-    JobPool jp;
-
-    // Pool of jobs read->split->write
-    JobPool::jobptr_t read_j  = JobPool::jobptr_t(new WavPcmReadJob(fi,read_q));
-    JobPool::jobptr_t split_j = JobPool::jobptr_t(new SplitJob(read_q,left_q,right_q));
-    JobPool::jobptr_t left_j = JobPool::jobptr_t(new WavPcmWriteJob("left.wav",left_q));
-    JobPool::jobptr_t right_j = JobPool::jobptr_t(new WavPcmWriteJob("right.wav",right_q));
-
-    // Add jobs ti pool
-    jp.addJobs({read_j,split_j,left_j,right_j});
-
-    // start the bool
-    jp.start();
+        if(!pf)
+        {
+            std::cerr << "Failed to write 'placement.json'" << std::endl;
+            return 1;
+        }
+    }
 
-    // pool waits for all threads in destructor
     return 0;
 }
@@ -0,0 +1,728 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wavjobs.h"
+#include "feedbackloop.h"
+
+// Microbenchmarks of the wavefilter building blocks plus end to end
+// runs over synthetic WAVs. Results go to stdout (or --out) as JSON,
+// one result per line so two runs diff line by line.
+
+namespace {
+
+typedef std::chrono::steady_clock clock_t;
+
+// A deterministic WAV generated on the fly. The PCM data repeats a
+// precomputed pattern, so producing it costs next to nothing and
+// files of several GB need no disk and no memory.
+
+class SyntheticSource : public ByteSource {
+public:
+    SyntheticSource(uint32_t rate,int channels,int bits,uint64_t frames)
+        : _frameSize(channels * bits / 8)
+        , _dataBytes(frames * _frameSize)
+    {
+        uint64_t riff = std::min<uint64_t>(_dataBytes + 36,0xffffffff);
+        uint64_t data = std::min<uint64_t>(_dataBytes,0xffffffff);
+
+        putTag("RIFF");
+        putLong(uint32_t(riff));
+        putTag("WAVE");
+        putTag("fmt ");
+        putLong(16);
+        putWord(1);
+        putWord(channels);
+        putLong(rate);
+        putLong(rate * _frameSize);
+        putWord(_frameSize);
+        putWord(bits);
+        putTag("data");
+        putLong(uint32_t(data));
+
+        // Sine plus noise from a fixed LCG seed, signed little endian
+        _pattern.resize(patternFrames * _frameSize);
+        uint32_t lcg = 12345;
+        uint8_t * p = _pattern.data();
+
+        for(size_t i=0;i<patternFrames;i++)
+        {
+            for(int c=0;c<channels;c++)
+            {
+                lcg = lcg * 1664525u + 1013904223u;
+
+                double v = 0.5 * std::sin(2.0 * M_PI * 997.0 * (c + 1) * double(i) / double(rate))
+                         + 0.1 * (double(lcg >> 8) / double(1 << 24) - 0.5);
+                int64_t s = int64_t(v * double((int64_t(1) << (bits - 1)) - 1));
+
+                if(bits == 8)
+                {
+                    s += 128; // 8 bit PCM is unsigned
+                }
+
+                for(int b=0;b<bits/8;b++)
+                {
+                    *(p++) = uint8_t(s >> (8 * b));
+                }
+            }
+        }
+    }
+
+    bool read(uint8_t * buf,size_t n) override
+    {
+        if(_hdrPos + n > _header.size())
+        {
+            return false;
+        }
+
+        std::memcpy(buf,_header.data() + _hdrPos,n);
+        _hdrPos += n;
+        return true;
+    }
+
+    const uint8_t * next(size_t max,size_t & n) override
+    {
+        n = size_t(std::min<uint64_t>({uint64_t(max),
+                                       uint64_t(_pattern.size() - _patPos),
+                                       _dataBytes - _dataPos}));
+        if(n==0)
+        {
+            return nullptr;
+        }
+
+        const uint8_t * p = _pattern.data() + _patPos;
+
+        _patPos   = (_patPos + n) % _pattern.size();
+        _dataPos += n;
+
+        return p;
+    }
+
+    uint64_t dataBytes() const
+    {
+        return _dataBytes;
+    }
+
+private:
+    // Multiple of the reader's 1000 frame chunks
+    static const size_t patternFrames = 64000;
+
+    void putTag(const char * t)
+    {
+        _header.insert(_header.end(),t,t+4);
+    }
+
+    void putLong(uint32_t l)
+    {
+        for(int i=0;i<4;i++,l>>=8)
+        {
+            _header.push_back(uint8_t(l & 0xff));
+        }
+    }
+
+    void putWord(uint16_t w)
+    {
+        _header.push_back(uint8_t(w & 0xff));
+        _header.push_back(uint8_t(w >> 8));
+    }
+
+    size_t _frameSize;
+    uint64_t _dataBytes;
+    uint64_t _dataPos = 0;
+    size_t _patPos = 0;
+    size_t _hdrPos = 0;
+    std::vector<uint8_t> _header;
+    std::vector<uint8_t> _pattern;
+};
+
+// Swallows everything the writer produces
+
+class NullSink : public ByteSink {
+public:
+    size_t maxChunk() const override
+    {
+        return std::numeric_limits<size_t>::max();
+    }
+
+    uint8_t * buffer(size_t n) override
+    {
+        if(_buff.size() < n)
+        {
+            _buff.resize(n);
+        }
+        return _buff.data();
+    }
+
+    bool commit(size_t n) override
+    {
+        _bytes += n;
+        return true;
+    }
+
+    bool writeAt(uint64_t,const uint8_t *,size_t) override
+    {
+        return true;
+    }
+
+    bool good() const override
+    {
+        return true;
+    }
+
+private:
+    std::vector<uint8_t> _buff;
+    uint64_t _bytes = 0;
+};
+
+class Report {
+public:
+    struct Param {
+        std::string name;
+        std::string value;
+    };
+
+    // extra: further "key": value pairs of the result, may be empty
+    void add(const std::string & name,const std::vector<Param> & params,
+             double seconds,uint64_t items,uint64_t bytes,const std::string & extra = "")
+    {
+        std::stringstream ss;
+
+        ss << std::setprecision(6)
+           << "{\"name\": \"" << name << "\", \"params\": {";
+
+        for(size_t i=0;i<params.size();i++)
+        {
+            ss << (i ? ", " : "") << "\"" << params[i].name << "\": " << params[i].value;
+        }
+
+        ss << "}, \"seconds\": " << seconds
+           << ", \"items\": " << items
+           << ", \"items_per_second\": " << double(items) / seconds
+           << ", \"bytes\": " << bytes
+           << ", \"bytes_per_second\": " << double(bytes) / seconds
+           << (extra.empty() ? "" : ", ") << extra
+           << "}";
+
+        std::cerr << ss.str() << std::endl;
+        _results.push_back(ss.str());
+    }
+
+    // A complete result object
+    void addRaw(const std::string & json)
+    {
+        std::cerr << json << std::endl;
+        _results.push_back(json);
+    }
+
+    void writeJson(std::ostream & os)
+    {
+        os << "{" << std::endl
+           << "  \"suite\": \"wavefilter_bench\"," << std::endl
+           << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << "," << std::endl
+           << "  \"results\": [" << std::endl;
+
+        for(size_t i=0;i<_results.size();i++)
+        {
+            os << "    " << _results[i] << (i+1 < _results.size() ? "," : "") << std::endl;
+        }
+
+        os << "  ]" << std::endl
+           << "}" << std::endl;
+    }
+
+private:
+    std::vector<std::string> _results;
+};
+
+template<class T>
+Report::Param param(const std::string & name,const T & value)
+{
+    std::stringstream ss;
+    ss << value;
+    return Report::Param{name,ss.str()};
+}
+
+double since(clock_t::time_point t0)
+{
+    return std::chrono::duration<double>(clock_t::now() - t0).count();
+}
+
+// Chunks through a bounded queue between producer and consumer threads
+void benchQueue(Report & report,int producers,int consumers,size_t items)
+{
+    JobQueue q;
+    JobQueue::dataptr_t chunk(new JobQueue::Data(1000));
+    std::vector<std::thread> threads;
+
+    auto t0 = clock_t::now();
+
+    for(int c=0;c<consumers;c++)
+    {
+        threads.push_back(std::thread([&q](){
+            JobQueue::dataptr_t d;
+            while(q.pop(d));
+        }));
+    }
+
+    std::vector<std::thread> pushers;
+
+    for(int p=0;p<producers;p++)
+    {
+        size_t n = items / producers + (size_t(p) < items % producers ? 1 : 0);
+
+        pushers.push_back(std::thread([&q,&chunk,n](){
+            for(size_t i=0;i<n;i++)
+            {
+                q.push(chunk);
+            }
+        }));
+    }
+
+    for(auto & t : pushers)
+    {
+        t.join();
+    }
+
+    q.finish();
+
+    for(auto & t : threads)
+    {
+        t.join();
+    }
+
+    report.add("queue",{param("producers",producers),param("consumers",consumers)},since(t0),items,0);
+}
+
+// WavPcmReadJob decoding alone, popped right away on the same thread
+void benchDecode(Report & report,int bits,int channels,uint64_t bytes)
+{
+    uint64_t frames = bytes / (channels * bits / 8);
+    JobQueue q(0);
+    WavPcmReadJob reader(std::unique_ptr<ByteSource>(new SyntheticSource(44100,channels,bits,frames)),q);
+    JobQueue::dataptr_t d;
+    uint64_t samples = 0;
+
+    auto t0 = clock_t::now();
+
+    while(reader.run().get())
+    {
+        q.pop(d);
+        samples += d->_vector.size();
+    }
+
+    report.add("decode",{param("bits",bits),param("channels",channels)},since(t0),samples,frames * channels * bits / 8);
+}
+
+void benchSplit(Report & report,size_t chunkSize,size_t chunks)
+{
+    JobQueue from(0);
+    JobQueue left(0);
+    JobQueue right(0);
+    SplitJob split(from,left,right);
+    JobQueue::dataptr_t chunk(new JobQueue::Data(chunkSize));
+    JobQueue::dataptr_t d;
+
+    auto t0 = clock_t::now();
+
+    for(size_t i=0;i<chunks;i++)
+    {
+        from.push(chunk);
+        split.run().get();
+        left.pop(d);
+        right.pop(d);
+    }
+
+    report.add("split",{param("chunk",chunkSize)},since(t0),chunks * chunkSize,chunks * chunkSize * sizeof(float));
+}
+
+void benchWrite(Report & report,size_t chunkSize,size_t chunks)
+{
+    JobQueue from(0);
+    WavPcmWriteJob writer(std::unique_ptr<ByteSink>(new NullSink()),from,44100);
+    JobQueue::dataptr_t chunk(new JobQueue::Data(chunkSize));
+
+    for(size_t i=0;i<chunkSize;i++)
+    {
+        chunk->_vector[i] = std::sin(double(i));
+    }
+
+    auto t0 = clock_t::now();
+
+    for(size_t i=0;i<chunks;i++)
+    {
+        from.push(chunk);
+        writer.run().get();
+    }
+
+    report.add("write",{param("chunk",chunkSize)},since(t0),chunks * chunkSize,chunks * chunkSize);
+}
+
+// FlacEncoder alone on one block of tones plus some noise
+void benchFlac(Report & report,int bits,uint32_t blockSize,size_t blocks)
+{
+    FlacEncoder encoder(bits,blockSize);
+    std::vector<int32_t> x(blockSize);
+    std::vector<uint8_t> frame;
+    const double scale = double((1 << (bits - 1)) - 1);
+    uint32_t noise = 1;
+
+    for(size_t i=0;i<blockSize;i++)
+    {
+        noise = noise * 1664525u + 1013904223u;
+        double v = 0.5 * std::sin(0.031 * double(i)) + 0.2 * std::sin(0.17 * double(i))
+            + 0.01 * (double(noise >> 8) / double(1 << 24) - 0.5);
+        x[i] = int32_t(v * scale);
+    }
+
+    uint64_t bytes = 0;
+
+    auto t0 = clock_t::now();
+
+    for(size_t i=0;i<blocks;i++)
+    {
+        frame.clear();
+        encoder.encodeFrame(x.data(),x.size(),i,frame);
+        bytes += frame.size();
+    }
+
+    double seconds = since(t0);
+    std::stringstream ratio;
+    ratio << "\"ratio\": " << double(bytes) / double(blocks * blockSize * bits / 8);
+
+    report.add("flac",{param("bits",bits),param("block",blockSize)},seconds,blocks * blockSize,
+               blocks * blockSize * bits / 8,ratio.str());
+}
+
+void benchFeedback(Report & report,size_t length,bool loop,size_t repeat)
+{
+    std::vector<std::shared_ptr<AudioEffect>> chain(length);
+
+    for(size_t i=0;i<length;i++)
+    {
+        chain[i].reset(new DummyEffect());
+        if(i>0)
+        {
+            chain[i-1]->next = chain[i];
+        }
+    }
+
+    if(loop)
+    {
+        chain.back()->next = chain[length / 2];
+    }
+
+    int n = 0;
+    size_t hits = 0;
+
+    auto t0 = clock_t::now();
+
+    for(size_t r=0;r<repeat;r++)
+    {
+        hits += detect_feedback(chain.front().get(),n) ? 1 : 0;
+    }
+
+    double s = since(t0);
+
+    if(hits != (loop ? repeat : 0) || size_t(n) != length)
+    {
+        throw std::runtime_error("detect_feedback returned wrong result");
+    }
+
+    // Unlink so neither the loop leaks nor the chain recurses on destruction
+    for(auto & e : chain)
+    {
+        e->next.reset();
+    }
+
+    report.add("detect_feedback",{param("length",length),param("loop",loop ? "true" : "false")},s,length * repeat,0);
+}
+
+// read -> split -> 2x write like main() without files, either in a
+// JobPool or on one thread in a JobExecutor. Jobs and the synthetic
+// input are set up before the clock starts.
+double runPipeline(uint32_t rate,int channels,int bits,uint64_t frames,bool single,
+                   JobPool::Placement placement = JobPool::Placement::None,std::ostream * where = nullptr)
+{
+    JobQueue read_q;
+    JobQueue left_q;
+    JobQueue right_q;
+
+    std::vector<JobPool::jobptr_t> jobs = {
+        JobPool::jobptr_t(new WavPcmReadJob(std::unique_ptr<ByteSource>(new SyntheticSource(rate,channels,bits,frames)),read_q)),
+        JobPool::jobptr_t(new SplitJob(read_q,left_q,right_q)),
+        JobPool::jobptr_t(new WavPcmWriteJob(std::unique_ptr<ByteSink>(new NullSink()),left_q,rate)),
+        JobPool::jobptr_t(new WavPcmWriteJob(std::unique_ptr<ByteSink>(new NullSink()),right_q,rate))
+    };
+
+    auto t0 = clock_t::now();
+
+    if(single)
+    {
+        JobExecutor ex;
+
+        ex.addJobs(std::move(jobs));
+        ex.run();
+    }
+    else
+    {
+        JobPool jp;
+
+        jp.setPlacement(placement);
+        jp.addJobs(std::move(jobs));
+        jp.start();
+        jp.join();
+
+        if(where)
+        {
+            jp.writePlacement(*where);
+        }
+    }
+
+    return since(t0);
+}
+
+void benchPipeline(Report & report,uint32_t rate,int channels,int bits,uint64_t bytes,
+                   JobPool::Placement placement = JobPool::Placement::None)
+{
+    uint64_t frames = bytes / (channels * bits / 8);
+    std::stringstream where;
+
+    where << "\"placement\": ";
+    double s = runPipeline(rate,channels,bits,frames,false,placement,&where);
+
+    report.add("pipeline",{param("rate",rate),param("channels",channels),param("bits",bits),param("mb",bytes >> 20),
+                           param("placement","\"" + JobPool::placementName(placement) + "\"")},
+               s,frames * channels,frames * channels * bits / 8,where.str());
+}
+
+// Threaded JobPool against the single threaded JobExecutor over
+// growing inputs. The crossover is the smallest size from which on
+// threads are faster.
+void benchExecutor(Report & report,uint64_t maxBytes,double minSeconds)
+{
+    const int channels = 2;
+    const int bits = 16;
+    uint64_t crossover = 0;
+
+    for(uint64_t bytes=4096;bytes<=maxBytes;bytes*=4)
+    {
+        uint64_t frames = bytes / (channels * bits / 8);
+        double t[2] = {0,0};
+
+        for(int single=0;single<2;single++)
+        {
+            size_t runs = 0;
+
+            // Small inputs take microseconds, repeat them
+            while(runs < 3 || t[single] < minSeconds)
+            {
+                t[single] += runPipeline(44100,channels,bits,frames,single != 0);
+                runs++;
+            }
+
+            report.add("executor",{param("mode",single ? "\"single\"" : "\"threads\""),param("kb",bytes >> 10)},
+                       t[single],runs * frames * channels,runs * bytes);
+
+            t[single] /= double(runs);
+        }
+
+        if(t[0] < t[1])
+        {
+            crossover = crossover ? crossover : bytes;
+        }
+        else
+        {
+            crossover = 0;
+        }
+    }
+
+    std::stringstream ss;
+
+    ss << "{\"name\": \"executor_crossover\", \"params\": {}, \"threads_faster_from_bytes\": ";
+
+    if(crossover)
+    {
+        ss << crossover;
+    }
+    else
+    {
+        ss << "null";
+    }
+
+    ss << "}";
+    report.addRaw(ss.str());
+}
+
+bool selected(const std::string & filter,const std::string & name)
+{
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    bool large = false;
+    uint64_t scale = 1;
+    std::string filter;
+    std::string out;
+
+    for(int i=1;i<argc;i++)
+    {
+        std::string arg = argv[i];
+
+        if(arg=="--quick")
+        {
+            scale = 8;
+        }
+        else if(arg=="--large")
+        {
+            large = true;
+        }
+        else if(arg=="--filter" && i+1<argc)
+        {
+            filter = argv[++i];
+        }
+        else if(arg=="--out" && i+1<argc)
+        {
+            out = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--quick] [--large] [--filter name] [--out results.json]" << std::endl
+                      << "  --quick   1/8 of the default sizes" << std::endl
+                      << "  --large   add end to end runs over multi GB files" << std::endl
+                      << "  --filter  only run benchmarks whose name contains name" << std::endl;
+            ::exit(1);
+        }
+    }
+
+    const uint64_t MB = 1 << 20;
+    Report report;
+
+    if(selected(filter,"queue"))
+    {
+        const int threads[][2] = {{1,1},{1,2},{2,1},{2,2},{4,4},{8,8}};
+
+        for(auto & t : threads)
+        {
+            benchQueue(report,t[0],t[1],400000 / scale);
+        }
+    }
+
+    if(selected(filter,"decode"))
+    {
+        for(int bits : {8,16,24,32})
+        {
+            for(int channels : {1,2})
+            {
+                benchDecode(report,bits,channels,128 * MB / scale);
+            }
+        }
+    }
+
+    if(selected(filter,"split"))
+    {
+        for(size_t chunk : {size_t(1000),size_t(2000),size_t(1999)})
+        {
+            benchSplit(report,chunk,200000 / scale);
+        }
+    }
+
+    if(selected(filter,"write"))
+    {
+        for(size_t chunk : {size_t(1000),size_t(4096)})
+        {
+            benchWrite(report,chunk,200000 / scale);
+        }
+    }
+
+    if(selected(filter,"flac"))
+    {
+        for(int bits : {8,16,24})
+        {
+            for(uint32_t block : {1152u,4096u})
+            {
+                benchFlac(report,bits,block,std::max<size_t>(1,4000000 / scale / block));
+            }
+        }
+    }
+
+    if(selected(filter,"detect_feedback"))
+    {
+        for(size_t length : {size_t(100),size_t(10000),size_t(100000)})
+        {
+            for(bool loop : {false,true})
+            {
+                benchFeedback(report,length,loop,std::max<size_t>(1,4000000 / scale / length));
+            }
+        }
+    }
+
+    if(selected(filter,"pipeline"))
+    {
+        for(uint32_t rate : {22050u,44100u,48000u,96000u})
+        {
+            for(int channels : {1,2})
+            {
+                benchPipeline(report,rate,channels,16,64 * MB / scale);
+            }
+        }
+
+        for(int bits : {8,24,32})
+        {
+            benchPipeline(report,48000,2,bits,64 * MB / scale);
+        }
+
+        std::vector<uint64_t> lengths = {16 * MB,256 * MB};
+
+        if(large)
+        {
+            // WAV sizes are 32 bit, stay below 4GB
+            lengths.push_back(1024 * MB);
+            lengths.push_back(3 * 1024 * MB);
+        }
+
+        for(uint64_t len : lengths)
+        {
+            benchPipeline(report,44100,2,16,len / scale);
+        }
+
+        for(auto placement : {JobPool::Placement::Compact,JobPool::Placement::Spread})
+        {
+            benchPipeline(report,44100,2,16,256 * MB / scale,placement);
+        }
+    }
+
+    if(selected(filter,"executor"))
+    {
+        benchExecutor(report,64 * MB / scale,0.2 / double(scale));
+    }
+
+    if(out.empty())
+    {
+        report.writeJson(std::cout);
+    }
+    else
+    {
+        std::ofstream os(out);
+        report.writeJson(os);
+
+        if(!os)
+        {
+            std::cerr << "Failed to write '" << out << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,5 @@
+#include "wavjobs.h"
+
+const uint8_t * WavPcmReadJob::_dummyRef;
+
+uint8_t * WavPcmWriteJob::_dummy;
@@ -0,0 +1,889 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <iostream>
+#include <sstream>
+
+#include "jobpool.h"
+#include "byteio.h"
+#include "resampler.h"
+#include "meter.h"
+#include "flac.h"
+
+// Jobs of the wavefilter pipeline: read -> split -> [resample] ->
+// [analyze] -> write, or block -> encode x N -> write for FLAC
+// output. Each runs in its own thread of a JobPool, or as a
+// coroutine of a JobExecutor on a single thread.
+
+class SplitJob : public Job {
+
+public:
+    typedef JobQueue queue_t;
+    SplitJob(queue_t & from,queue_t & left,queue_t & right)
+        : _from(from)
+        , _left(left)
+        , _right(right)
+    {
+        consumes(_from);
+        produces(_left);
+        produces(_right);
+    }
+
+    Task run () override
+    {
+        queue_t::dataptr_t data;
+
+        if(!co_await _from.asyncPop(data))
+        {
+            _left.finish();
+            _right.finish();
+            co_return false;
+        }
+
+        queue_t::dataptr_t ldata;
+        queue_t::dataptr_t rdata;
+
+        bool odd = (data->_vector.size() & 1) != 0;
+
+        int ool = odd ? _oddToggle ? 1 : 0 : 0;
+        int oor = odd ? _oddToggle ? 0 : 1 : 0;
+
+
+        ldata = _left.alloc(data->_vector.size() / 2 + oor );
+        rdata = _right.alloc(data->_vector.size() / 2 + ool );
+#if 0
+        std::cerr << ool << "::" << oor << " @ "
+                  << ldata->_vector.size() << "::"
+                  << rdata->_vector.size() << "::"
+                  << std::endl;
+#endif
+        for(size_t i=0; i<data->_vector.size() / 2;i++)
+        {
+            ldata->_vector[ i ] = data->_vector[ i * 2 + ool ];
+            rdata->_vector[ i ] = data->_vector[ i * 2 + oor ];
+        }
+
+        if(odd)
+        {
+            if(_oddToggle)
+            {
+                rdata->_vector[data->_vector.size() / 2 ] = data->_vector.back();
+            }
+            else
+            {
+                ldata->_vector[data->_vector.size() / 2 ] = data->_vector.back();
+            }
+        }
+
+        _oddToggle = odd ? _oddToggle ? false : true : true ;
+
+        co_await _left.asyncPush(ldata);
+        co_await _right.asyncPush(rdata);
+
+        co_return true;
+    }
+
+private:
+    queue_t & _from;
+    queue_t & _left;
+    queue_t & _right;
+    size_t _oddToggle = false; // last data was odd sized
+};
+
+
+class WavPcmReadJob : public Job
+{
+public:
+    typedef JobQueue queue_t;
+
+    WavPcmReadJob(std::istream & is,queue_t & to)
+        : WavPcmReadJob(std::unique_ptr<ByteSource>(new StreamSource(is)),to)
+    {
+    }
+
+    WavPcmReadJob(std::unique_ptr<ByteSource> src,queue_t & to)
+        : _src(std::move(src))
+        , _to(to)
+    {
+        produces(_to);
+
+        ByteSource & is = *_src;
+
+        const std::string riffTag="RIFF";
+        static const int tagSize = 4;
+
+        uint8_t buff[tagSize];
+
+        if(!is.read(buff,tagSize) || std::string((char*)buff,tagSize)!=riffTag)
+        {
+            throw std::runtime_error("Failed to detect '" + riffTag +"'");
+        }
+
+        if(!is.read(buff,tagSize))
+        {
+            throw std::runtime_error("Failed to detect '" + riffTag + "' size");
+        }
+
+        size_t size = getLong(buff);
+
+        const std::string wavTag ="WAVE";
+
+        if(!is.read(buff,tagSize) || std::string((char*)buff,tagSize)!=wavTag)
+        {
+            throw std::runtime_error("Failed to detect '" + wavTag + "'");
+        }
+
+        const std::string fmtTag ="fmt ";
+
+        if(!is.read(buff,tagSize) || std::string((char*)buff,tagSize)!=fmtTag)
+        {
+            throw std::runtime_error("Failed to detect '" + fmtTag + "'");
+        }
+
+        if(!is.read(buff,tagSize))
+        {
+            throw std::runtime_error("Failed to detect '" + fmtTag + "' size");
+        }
+        size = getLong(buff);
+        static const int fmtSize = 16;
+        if(size!=fmtSize)
+        {
+            std::stringstream ss;
+            ss << "expected fmt chunk of size " << fmtSize;
+            throw std::runtime_error(ss.str());
+        }
+
+        uint8_t fmtBuff[fmtSize];
+
+        if(!is.read(fmtBuff,fmtSize))
+        {
+            throw std::runtime_error("Failed to read '" + fmtTag + "' buffer");
+        }
+
+        const std::string dataTag ="data";
+
+        if(!is.read(buff,tagSize) || std::string((char*)buff,tagSize)!=dataTag)
+        {
+            throw std::runtime_error("Failed to detect '" + dataTag + "'");
+        }
+
+        if(!is.read(buff,tagSize) )
+        {
+            throw std::runtime_error("Failed to read '" + dataTag + "' size");
+        }
+
+        _dataSize = getLong(buff);
+
+        const uint8_t * fmtPtr = fmtBuff;
+
+        if(getWord(fmtPtr,fmtPtr)!=1)
+        {
+            throw std::runtime_error("Only handle PCM data");
+        }
+
+        _channels = getWord(fmtPtr,fmtPtr);
+        if(_channels!=1 && _channels!=2)
+        {
+            throw std::runtime_error("Only handle Mono/Stereo");
+        }
+
+        _sampleRate = getLong(fmtPtr,fmtPtr);
+        _dataRate = getLong(fmtPtr,fmtPtr);
+        _frameSize = getWord(fmtPtr,fmtPtr);
+        _bitSize  = getWord(fmtPtr,fmtPtr);
+
+        if(_bitSize != 8 && _bitSize != 16 &&  _bitSize != 24 &&  _bitSize != 32)
+        {
+            throw std::runtime_error("Sorr only 8/16/24/32 bts/sample for now");
+        }
+
+        std::cerr << "Channels:" << _channels << " "
+                  << "SampleRate:" << _sampleRate << " "
+                  << "DataRate:" << _dataRate << " "
+                  << "FrameSize:" << _frameSize << " "
+                  << "BitSize:" << _bitSize << " "
+                  << "Datasize:" << _dataSize << std::endl;
+
+
+        if(_frameSize != _channels * _bitSize / 8)
+        {
+            std::stringstream ss;
+            ss<< "Expected FrameSize to be " << _channels * _bitSize / 8;
+            throw std::runtime_error(ss.str());
+        }
+
+        if(_dataRate != _frameSize * _sampleRate)
+        {
+            std::stringstream ss;
+            ss<< "Expected DataRate to be " <<_frameSize * _sampleRate;
+            throw std::runtime_error(ss.str());
+        }
+    }
+    virtual
+    ~WavPcmReadJob()
+    {
+        std::cerr << "Samples read:" << _samplesRead << std::endl;
+    }
+
+public:
+    int channels() const
+    {
+        return _channels;
+    }
+
+    uint32_t sampleRate() const
+    {
+        return _sampleRate;
+    }
+
+    // Size of the PCM data as announced by the header
+    size_t dataSize() const
+    {
+        return _dataSize;
+    }
+
+    // Samples of all channels as announced by the header
+    size_t samples() const
+    {
+        return _dataSize / _frameSize * _channels;
+    }
+
+    Task run() override
+    {
+        static const size_t chunkSize = 1000;
+        size_t n = 0;
+        const uint8_t * ptr = _src->next(_frameSize*chunkSize,n);
+
+        if(n==0)
+        {
+            _to.finish();
+            co_return false;
+        }
+
+        if(n % (_frameSize) != 0 )
+        {
+            std::stringstream ss;
+            ss << " expected read bytes to be multiples of " << _frameSize << " found " << n;
+            throw std::runtime_error(ss.str());
+        }
+
+        queue_t::dataptr_t data = _to.alloc( n / _frameSize * _channels );
+
+        size_t oidx = 0;
+
+        for(size_t i=0;i<n / _frameSize ;i++)
+        {
+            for(int j=0;j<_channels;j++)
+            {
+                long lo=0;
+                unsigned long mx=0;
+
+                for(int k=1;k<=_bitSize/8;k++)
+                {
+                    lo <<= 8;
+                    mx <<= 8;
+                    lo  |= ptr[ _bitSize / 8 - k ];
+                    mx  |= 0xff;
+                }
+
+                ptr += _bitSize/8;
+                data->_vector[oidx] = 1.0f - float(lo) / float( mx / 2 );
+                oidx++;
+            }
+        }
+
+        _samplesRead += data->_vector.size();
+
+        co_await _to.asyncPush(data);
+        co_return true;
+    }
+
+private:
+    uint16_t getWord(const uint8_t * buff,const uint8_t * & next=_dummyRef)
+    {
+        uint16_t w = uint16_t(buff[1]) << 8 | uint16_t(buff[0]);
+        next = buff+2;
+        return w;
+    }
+
+    uint32_t getLong(const uint8_t * buff,const uint8_t * & next=_dummyRef)
+    {
+        uint32_t l = uint32_t(buff[3]) << 24 | uint32_t(buff[2]) << 16 | uint32_t(buff[1]) << 8 | uint32_t(buff[0]);
+        next = buff+4;
+        return l;
+    }
+
+    int _channels;
+    uint32_t _sampleRate;
+    uint32_t _dataRate;
+    uint16_t _frameSize;
+    uint16_t _bitSize;
+    size_t _dataSize;
+    size_t _samplesRead=0;
+    static const uint8_t * _dummyRef;
+    std::unique_ptr<ByteSource> _src;
+    queue_t & _to;
+};
+
+
+
+// Converts one channel from inRate to outRate. Runs once per
+// channel so channels are resampled in parallel threads.
+
+class ResampleJob : public Job
+{
+public:
+    typedef JobQueue queue_t;
+
+    ResampleJob(queue_t & from,queue_t & to,uint32_t inRate,uint32_t outRate)
+        : _from(from)
+        , _to(to)
+        , _resampler(inRate,outRate)
+    {
+        consumes(_from);
+        produces(_to);
+    }
+
+    Task run() override
+    {
+        queue_t::dataptr_t data;
+
+        _out.clear();
+
+        if(!co_await _from.asyncPop(data))
+        {
+            _resampler.flush(_out);
+
+            if(!_out.empty())
+            {
+                co_await _to.asyncPush(take());
+            }
+
+            _to.finish();
+            co_return false;
+        }
+
+        _resampler.process(data->_vector.data(),data->_vector.size(),_out);
+
+        if(!_out.empty())
+        {
+            co_await _to.asyncPush(take());
+        }
+
+        co_return true;
+    }
+
+private:
+    // The converted samples in a chunk of the next queue
+    queue_t::dataptr_t take()
+    {
+        queue_t::dataptr_t out = _to.alloc(_out.size());
+
+        std::copy(_out.begin(),_out.end(),out->_vector.begin());
+        return out;
+    }
+
+    queue_t & _from;
+    queue_t & _to;
+    Resampler _resampler;
+    std::vector<float> _out;
+};
+
+
+// Pass-through stage on any queue edge. Forwards the chunks
+// unchanged (same pointer, no copy) and accumulates level
+// statistics, which are merged into the meter at end of stream.
+
+class AnalysisTapJob : public Job
+{
+public:
+    typedef JobQueue queue_t;
+
+    AnalysisTapJob(queue_t & from,queue_t & to,Meter & meter)
+        : _from(from)
+        , _to(to)
+        , _meter(meter)
+        , _stats(meter.channels())
+        , _oversamplers(meter.channels(),Resampler(1,trueOversampling,trueTaps))
+    {
+        consumes(_from);
+        produces(_to);
+    }
+
+    Task run() override
+    {
+        queue_t::dataptr_t data;
+
+        if(!co_await _from.asyncPop(data))
+        {
+            for(size_t c=0;c<_stats.size();c++)
+            {
+                _scratch.clear();
+                _oversamplers[c].flush(_scratch);
+                _stats[c].addTruePeak(_scratch.data(),_scratch.size());
+            }
+
+            _meter.merge(_stats);
+            _to.finish();
+            co_return false;
+        }
+
+        const queue_t::Data::vector_t & v = data->_vector;
+        const size_t channels = _stats.size();
+        const size_t frames = v.size() / channels;
+
+        for(size_t c=0;c<channels;c++)
+        {
+            _stats[c].add(v.data() + c,frames,channels);
+
+            // Inter sample peaks from a 4x oversampled copy
+            _scratch.clear();
+
+            if(channels==1)
+            {
+                _oversamplers[c].process(v.data(),frames,_scratch);
+            }
+            else
+            {
+                _channel.resize(frames);
+
+                for(size_t i=0;i<frames;i++)
+                {
+                    _channel[i] = v[i*channels+c];
+                }
+                _oversamplers[c].process(_channel.data(),frames,_scratch);
+            }
+
+            _stats[c].addTruePeak(_scratch.data(),_scratch.size());
+        }
+
+        co_await _to.asyncPush(data);
+        co_return true;
+    }
+
+private:
+    static const uint32_t trueOversampling = 4;
+    static const size_t trueTaps = 48;
+
+    queue_t & _from;
+    queue_t & _to;
+    Meter & _meter;
+    std::vector<ChannelStats> _stats;
+    std::vector<Resampler> _oversamplers;
+    std::vector<float> _channel;
+    std::vector<float> _scratch;
+};
+
+
+class WavPcmWriteJob : public Job
+{
+    typedef Job super;
+public:
+    typedef JobQueue queue_t;
+
+    WavPcmWriteJob(std::ostream & os,queue_t & from,uint32_t sampleRate=44100)
+        : WavPcmWriteJob(std::unique_ptr<ByteSink>(new StreamSink(os)),from,sampleRate)
+    {
+    }
+
+    WavPcmWriteJob(const std::string & fname,queue_t & from,uint32_t sampleRate=44100)
+        : WavPcmWriteJob(std::unique_ptr<ByteSink>(new StreamSink(fname)),from,sampleRate)
+    {
+    }
+
+    WavPcmWriteJob(std::unique_ptr<ByteSink> sink,queue_t & from,uint32_t sampleRate=44100)
+        : _sampleRate(sampleRate)
+        , _sink(std::move(sink))
+        , _from(from)
+    {
+        consumes(_from);
+        writeHeader();
+    }
+
+    virtual
+    ~WavPcmWriteJob() override
+    {
+        _from.finish();
+        if(_sink->good())
+        {
+            std::vector<uint8_t> size(4);
+            putLong(size.data(),_dataSize+34);
+            _sink->writeAt(4,size.data(),size.size());
+
+            putLong(size.data(),_dataSize);
+            _sink->writeAt(40,size.data(),size.size());
+        }
+    }
+
+    Task run() override
+    {
+        queue_t::dataptr_t data;
+
+        if(!co_await _from.asyncPop(data))
+        {
+            co_return false;
+        }
+
+        // Convert straight into the sink's buffer, in pieces it can take
+        const queue_t::Data::vector_t & v = data->_vector;
+
+        for(size_t i=0;i<v.size();)
+        {
+            size_t n = std::min(v.size() - i,_sink->maxChunk());
+            int8_t *ptr = (int8_t *)_sink->buffer(n);
+
+            for(size_t j=0;j<n;j++)
+            {
+                // std::cerr << data->_vector[i]  << "::"
+                //          << (int)int8_t(data->_vector[i] * float(0x7f)) << std::endl;
+
+                // Clipped, resampler overshoot must not wrap around
+                *(ptr++) = int8_t(std::min(127.0f,std::max(-128.0f,v[i+j] * float(0x7f))));
+            }
+
+            if( ! _sink->commit(n) )
+            {
+                co_return false;
+            }
+
+            i += n;
+            _dataSize += n;
+        }
+
+        co_return true;
+    }
+
+private:
+
+    void writeHeader()
+    {
+        std::string tag="RIFF";
+        put(tag.c_str(),tag.size());
+        std::vector<uint8_t> size(4);
+
+        putLong(size.data(),0x01020304);
+        put(size.data(),size.size());
+
+        tag="WAVE";
+        put(tag.c_str(),tag.size());
+
+        tag="fmt ";
+        put(tag.c_str(),tag.size());
+
+        putLong(size.data(),16);
+        put(size.data(),size.size());
+
+        std::vector<uint8_t> fmt(16);
+        uint8_t * fmpt = fmt.data();
+
+        putWord(fmpt,1,fmpt); //PCM
+        putWord(fmpt,1,fmpt); // CHANELS
+        putLong(fmpt,_sampleRate,fmpt);
+        putLong(fmpt,_sampleRate,fmpt); // 1 byte per frame
+        putWord(fmpt,1,fmpt); // frame
+        putWord(fmpt,8,fmpt); // bits
+
+        put(fmt.data(),fmt.size());
+
+        tag="data";
+        put(tag.c_str(),tag.size());
+
+        putLong(size.data(),0xf1f2f3f4);
+        put(size.data(),size.size());
+    }
+
+    void put(const void * data,size_t n)
+    {
+        std::copy((const uint8_t *)data,(const uint8_t *)data + n,_sink->buffer(n));
+        _sink->commit(n);
+    }
+
+    void putLong(uint8_t *data,unsigned long l, uint8_t * & next=_dummy)
+    {
+        for(int i=0;i<4;i++)
+        {
+            data[i] = uint8_t(l & 0xff);
+            l >>= 8;
+        }
+        next = data+4;
+    }
+    void putWord(uint8_t *data,unsigned int l,uint8_t * & next = _dummy)
+    {
+        for(int i=0;i<2;i++)
+        {
+            data[i] = uint8_t(l & 0xff);
+            l >>= 8;
+        }
+        next = data+2;
+    }
+    size_t _dataSize=0;
+    uint32_t _sampleRate;
+    std::unique_ptr<ByteSink> _sink;
+    queue_t & _from;
+    static uint8_t * _dummy;
+};
+
+
+// Regroups one channel into blocks of blockSize samples, numbered
+// in stream order, so independent blocks can be processed by
+// several jobs in parallel. The last block may be shorter.
+
+class BlockJob : public Job
+{
+public:
+    typedef JobQueue queue_t;
+
+    BlockJob(queue_t & from,queue_t & to,size_t blockSize)
+        : _from(from)
+        , _to(to)
+        , _blockSize(blockSize)
+    {
+        consumes(_from);
+        produces(_to);
+    }
+
+    Task run() override
+    {
+        queue_t::dataptr_t data;
+
+        if(!co_await _from.asyncPop(data))
+        {
+            if(_block && _fill > 0)
+            {
+                _block->_vector.resize(_fill);
+                co_await _to.asyncPush(take());
+            }
+
+            _to.finish();
+            co_return false;
+        }
+
+        const queue_t::Data::vector_t & v = data->_vector;
+
+        for(size_t i=0;i<v.size();)
+        {
+            if(!_block)
+            {
+                _block = _to.alloc(_blockSize);
+                _block->_seq = _seq++;
+                _fill = 0;
+            }
+
+            size_t n = std::min(v.size() - i,_blockSize - _fill);
+
+            std::copy(v.begin() + i,v.begin() + i + n,_block->_vector.begin() + _fill);
+            _fill += n;
+            i += n;
+
+            if(_fill==_blockSize)
+            {
+                co_await _to.asyncPush(take());
+            }
+        }
+
+        co_return true;
+    }
+
+private:
+    queue_t::dataptr_t take()
+    {
+        queue_t::dataptr_t block;
+
+        block.swap(_block);
+        return block;
+    }
+
+    queue_t & _from;
+    queue_t & _to;
+    size_t _blockSize;
+    queue_t::dataptr_t _block;
+    size_t _fill = 0;
+    uint64_t _seq = 0;
+};
+
+
+// Encodes blocks from BlockJob into FLAC frames in Data::_bytes
+// and passes them on in completion order. Several of these share
+// the queues; the last one to see the end finishes the output.
+
+class FlacEncodeJob : public Job
+{
+public:
+    typedef JobQueue queue_t;
+
+    FlacEncodeJob(queue_t & from,queue_t & to,std::shared_ptr<std::atomic<int>> running,
+                  int bits=8,uint32_t blockSize=4096)
+        : _from(from)
+        , _to(to)
+        , _running(running)
+        , _encoder(bits,blockSize)
+        , _max((int32_t(1) << (bits - 1)) - 1)
+    {
+        consumes(_from);
+        produces(_to);
+        ++*_running;
+    }
+
+    Task run() override
+    {
+        queue_t::dataptr_t data;
+
+        if(!co_await _from.asyncPop(data))
+        {
+            if(--*_running == 0)
+            {
+                _to.finish();
+            }
+            co_return false;
+        }
+
+        // Same truncation as WavPcmWriteJob, clipped instead of wrapped
+        const queue_t::Data::vector_t & v = data->_vector;
+        const float hi = float(_max);
+        const float lo = -float(_max) - 1.0f;
+
+        _samples.resize(v.size());
+
+        for(size_t i=0;i<v.size();i++)
+        {
+            _samples[i] = int32_t(std::min(hi,std::max(lo,v[i] * hi)));
+        }
+
+        data->_bytes.clear();
+        _encoder.encodeFrame(_samples.data(),_samples.size(),data->_seq,data->_bytes);
+
+        co_await _to.asyncPush(data);
+        co_return true;
+    }
+
+private:
+    queue_t & _from;
+    queue_t & _to;
+    std::shared_ptr<std::atomic<int>> _running;
+    FlacEncoder _encoder;
+    int32_t _max;
+    std::vector<int32_t> _samples;
+};
+
+
+// Writes the frames of FlacEncodeJob in frame order as a mono FLAC
+// file. STREAMINFO and the SEEKTABLE, one point per frame up to the
+// room reserved from expectedSamples, are rewritten at the end.
+
+class FlacWriteJob : public Job
+{
+public:
+    typedef JobQueue queue_t;
+
+    FlacWriteJob(std::unique_ptr<ByteSink> sink,queue_t & from,uint32_t sampleRate=44100,
+                 int bits=8,uint32_t blockSize=4096,std::optional<uint64_t> expectedSamples=std::nullopt)
+        : _sink(std::move(sink))
+        , _from(from)
+    {
+        consumes(_from);
+
+        _info.sampleRate = sampleRate;
+        _info.bits = bits;
+        _info.blockSize = blockSize;
+
+        // One point per frame when the length is known, at least one
+        // so even an empty stream has a table to rewrite
+        _seekCapacity = !expectedSamples ? defaultSeekPoints :
+            std::clamp<uint64_t>((*expectedSamples + blockSize - 1) / blockSize,1,maxSeekPoints);
+
+        std::vector<uint8_t> header;
+        FlacEncoder::writeHeader(_info,_points,_seekCapacity,header);
+        put(header.data(),header.size());
+    }
+
+    virtual
+    ~FlacWriteJob() override
+    {
+        _from.finish();
+        if(_sink->good())
+        {
+            std::vector<uint8_t> header;
+            FlacEncoder::writeHeader(_info,_points,_seekCapacity,header);
+            _sink->writeAt(0,header.data(),header.size());
+        }
+    }
+
+    Task run() override
+    {
+        queue_t::dataptr_t data;
+
+        if(!co_await _from.asyncPop(data))
+        {
+            if(!_pending.empty())
+            {
+                std::stringstream ss;
+                ss << "FLAC frame " << _next << " never arrived";
+                throw std::runtime_error(ss.str());
+            }
+            co_return false;
+        }
+
+        // Frames arrive as encoders finish them, hold back until
+        // the next one in order is there
+        _pending[data->_seq] = data;
+
+        for(auto it=_pending.find(_next);it!=_pending.end();it=_pending.find(_next))
+        {
+            const std::vector<uint8_t> & frame = it->second->_bytes;
+            const size_t samples = it->second->_vector.size();
+
+            if(!put(frame.data(),frame.size()))
+            {
+                co_return false;
+            }
+
+            _points.push_back({_info.totalSamples,_offset,uint16_t(samples)});
+
+            const uint32_t size = uint32_t(frame.size());
+            _info.minFrameSize = _next==0 ? size : std::min(_info.minFrameSize,size);
+            _info.maxFrameSize = std::max(_info.maxFrameSize,size);
+            _info.totalSamples += samples;
+            _offset += frame.size();
+
+            _pending.erase(it);
+            _next++;
+        }
+
+        co_return true;
+    }
+
+private:
+    // Seek points when the length isn't known, and the upper limit
+    static constexpr size_t defaultSeekPoints = 1024;
+    static constexpr size_t maxSeekPoints = 8192;
+
+    bool put(const uint8_t * data,size_t n)
+    {
+        for(size_t i=0;i<n;)
+        {
+            size_t m = std::min(n - i,_sink->maxChunk());
+
+            std::copy(data + i,data + i + m,_sink->buffer(m));
+            if(!_sink->commit(m))
+            {
+                return false;
+            }
+            i += m;
+        }
+        return true;
+    }
+
+    std::unique_ptr<ByteSink> _sink;
+    queue_t & _from;
+    FlacEncoder::StreamInfo _info;
+    std::vector<FlacEncoder::SeekPoint> _points;
+    size_t _seekCapacity;
+    std::map<uint64_t,queue_t::dataptr_t> _pending;
+    uint64_t _next = 0;
+    uint64_t _offset = 0;
+};